@@ -4,123 +4,23 @@
 #include <math.h>
 #include <string.h>
 
-// WAVヘッダ構造体（44バイト）
-#pragma pack(push, 1)
-typedef struct {
-    char riff[4];           // "RIFF"
-    int chunk_size;         // ファイルサイズ - 8
-    char wave[4];           // "WAVE"
-    char fmt[4];            // "fmt "
-    int fmt_size;           // 16 (PCM)
-    short audio_format;     // 1 (PCM)
-    short num_channels;     // 1 (Mono)
-    int sample_rate;        // 48000
-    int byte_rate;          // sample_rate * channels * bits/8
-    short block_align;      // channels * bits/8
-    short bits_per_sample;  // 16
-    char data[4];           // "data"
-    int data_size;          // 波形データサイズ (N * 2 bytes)
-} WavHeader;
-#pragma pack(pop)
+#include "wav_io.h"
 
-/**
- * WAVファイルを読み込む
- */
-int read_wav(const char *filename, int16_t **samples, int *fs, int *num_samples) {
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        fprintf(stderr, "エラー: %s を開けません\n", filename);
-        return -1;
-    }
-
-    WavHeader header;
-    if (fread(&header, sizeof(WavHeader), 1, fp) != 1) {
-        fprintf(stderr, "エラー: WAVヘッダの読み込みに失敗\n");
-        fclose(fp);
-        return -1;
-    }
-
-    // WAV形式のチェック
-    if (memcmp(header.riff, "RIFF", 4) != 0 || 
-        memcmp(header.wave, "WAVE", 4) != 0 ||
-        memcmp(header.fmt, "fmt ", 4) != 0 ||
-        memcmp(header.data, "data", 4) != 0) {
-        fprintf(stderr, "エラー: 無効なWAVファイル\n");
-        fclose(fp);
-        return -1;
-    }
-
-    *fs = header.sample_rate;
-    *num_samples = header.data_size / 2; // 16bit = 2 bytes
-
-    *samples = (int16_t *)malloc(*num_samples * sizeof(int16_t));
-    if (!*samples) {
-        fprintf(stderr, "エラー: メモリ確保に失敗\n");
-        fclose(fp);
-        return -1;
-    }
-
-    if (fread(*samples, sizeof(int16_t), *num_samples, fp) != *num_samples) {
-        fprintf(stderr, "エラー: データの読み込みに失敗\n");
-        free(*samples);
-        fclose(fp);
-        return -1;
-    }
-
-    fclose(fp);
-    return 0;
-}
-
-/**
- * WAVファイルに書き込む
- */
-int write_wav(const char *filename, int16_t *samples, int num_samples, int fs) {
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        fprintf(stderr, "エラー: %s を開けません\n", filename);
-        return -1;
-    }
-
-    WavHeader head;
-    memcpy(head.riff, "RIFF", 4);
-    head.chunk_size = 36 + num_samples * 2;
-    memcpy(head.wave, "WAVE", 4);
-    memcpy(head.fmt, "fmt ", 4);
-    head.fmt_size = 16;
-    head.audio_format = 1;
-    head.num_channels = 1;
-    head.sample_rate = fs;
-    head.bits_per_sample = 16;
-    head.byte_rate = fs * 2;
-    head.block_align = 2;
-    memcpy(head.data, "data", 4);
-    head.data_size = num_samples * 2;
-
-    fwrite(&head, sizeof(WavHeader), 1, fp);
-    fwrite(samples, sizeof(int16_t), num_samples, fp);
-
-    fclose(fp);
-    return 0;
-}
+// 一度に読み込んで処理するサンプル数
+#define NLMS_BLOCK 65536
 
 /**
  * NLMS適応フィルタ
  * 入力: x[n] (白色信号)
  * 出力: y[n] (録音信号)
  * 出力: h[n] (推定されたインパルス応答)
+ * 信号はブロックごとに渡してよい。h と遅延線 x_buf（長さ filter_len）は
+ * 呼び出し間で引き継ぐので、最初のブロックの前にゼロで初期化しておく。
  */
-void nlms_adaptive_filter(double *x, double *y, int x_len, int filter_len, 
-                          double *h, double mu, double beta) {
-    // フィルタ係数を初期化
-    for (int i = 0; i < filter_len; i++) {
-        h[i] = 0.0;
-    }
-
-    // 入力バッファ（遅延線）
-    double *x_buf = (double *)calloc(filter_len, sizeof(double));
-
+void nlms_adaptive_filter(double *x, double *y, int64_t x_len, int filter_len, 
+                          double *h, double *x_buf, double mu, double beta) {
     // NLMSアルゴリズム
-    for (int n = 0; n < x_len; n++) {
+    for (int64_t n = 0; n < x_len; n++) {
         // 入力バッファを更新（シフト）
         for (int i = filter_len - 1; i > 0; i--) {
             x_buf[i] = x_buf[i - 1];
@@ -150,11 +50,81 @@ void nlms_adaptive_filter(double *x, double *y, int x_len, int filter_len,
             }
         }
     }
+}
 
-    free(x_buf);
+/**
+ * NLMS適応フィルタ（単精度版、--precision float）
+ * 処理は nlms_adaptive_filter と同じ。フィルタ係数と遅延線を float で持つため
+ * 1サンプルごとに走査するメモリ量が半分になり、ベクトル幅は倍になる。
+ */
+void nlms_adaptive_filter_float(float *x, float *y, int64_t x_len, int filter_len,
+                                float *h, float *x_buf, float mu, float beta) {
+    for (int64_t n = 0; n < x_len; n++) {
+        memmove(x_buf + 1, x_buf, (filter_len - 1) * sizeof(float));
+        x_buf[0] = x[n];
+
+        float y_hat = 0.0f;
+        float x_power = beta;
+        for (int i = 0; i < filter_len; i++) {
+            y_hat += h[i] * x_buf[i];
+            x_power += x_buf[i] * x_buf[i];
+        }
+
+        float e = y[n] - y_hat;
+
+        if (x_power > 1e-10f) {
+            float step = mu * e / x_power;
+            for (int i = 0; i < filter_len; i++) {
+                h[i] += step * x_buf[i];
+            }
+        }
+    }
+}
+
+/**
+ * チャンネルごとのフィルタ係数を解放（使っている精度の方だけが確保されている）
+ */
+static void free_filters(double **h, float **hf, int channels) {
+    for (int c = 0; c < channels; c++) {
+        if (h) free(h[c]);
+        if (hf) free(hf[c]);
+    }
+    free(h);
+    free(hf);
 }
 
 int main(int argc, char *argv[]) {
+    // オプションを取り除き、残りを位置引数として前に詰める
+    int use_float = 0;
+    int out_format = WAV_FORMAT_PCM16;
+    int nargs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            const char *prec = argv[++i];
+            if (strcmp(prec, "float") == 0) {
+                use_float = 1;
+            } else if (strcmp(prec, "double") == 0) {
+                use_float = 0;
+            } else {
+                fprintf(stderr, "エラー: --precision は float または double を指定してください: %s\n", prec);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char *fmt = argv[++i];
+            if (strcmp(fmt, "pcm16") == 0) {
+                out_format = WAV_FORMAT_PCM16;
+            } else if (strcmp(fmt, "float") == 0) {
+                out_format = WAV_FORMAT_FLOAT32;
+            } else {
+                fprintf(stderr, "エラー: --format は pcm16 または float を指定してください: %s\n", fmt);
+                return 1;
+            }
+        } else {
+            argv[nargs++] = argv[i];
+        }
+    }
+    argc = nargs;
+
     const char *input_file = (argc > 1) ? argv[1] : "white_noise_180s.wav";
     const char *output_file = (argc > 2) ? argv[2] : "white_noise_response.wav";
     const char *ir_output = (argc > 3) ? argv[3] : "impulse_response_adaptive.wav";
@@ -164,88 +134,169 @@ int main(int argc, char *argv[]) {
     printf("入力信号: %s\n", input_file);
     printf("出力信号: %s\n", output_file);
     printf("フィルタ長: %d サンプル (%.3f 秒)\n", filter_len, (double)filter_len / 48000.0);
+    printf("演算精度: %s\n", use_float ? "単精度" : "倍精度");
 
-    // 1. 入力信号（白色信号）を読み込む
-    int16_t *input_samples = NULL;
-    int fs_input, input_len;
-    if (read_wav(input_file, &input_samples, &fs_input, &input_len) < 0) {
+    // 1. 入力信号（白色信号）を開く
+    // ファイル全体は読み込まず、NLMS_BLOCK サンプルずつ読みながら処理する
+    WavReader input;
+    if (wav_reader_open(input_file, &input) < 0) {
         fprintf(stderr, "エラー: 入力信号の読み込みに失敗\n");
         return 1;
     }
-    printf("入力信号: %d サンプル, fs = %d Hz\n", input_len, fs_input);
+    printf("入力信号: %lld サンプル, fs = %d Hz\n", (long long)input.num_frames, input.fs);
 
-    // 2. 出力信号（録音信号）を読み込む
-    int16_t *output_samples = NULL;
-    int fs_output, output_len;
-    if (read_wav(output_file, &output_samples, &fs_output, &output_len) < 0) {
+    // 2. 出力信号（録音信号）を開く
+    WavReader output;
+    if (wav_reader_open(output_file, &output) < 0) {
         fprintf(stderr, "エラー: 出力信号の読み込みに失敗\n");
-        free(input_samples);
+        wav_reader_close(&input);
         return 1;
     }
-    printf("出力信号: %d サンプル, fs = %d Hz\n", output_len, fs_output);
+    printf("出力信号: %lld サンプル, fs = %d Hz\n", (long long)output.num_frames, output.fs);
 
-    if (fs_input != fs_output) {
+    if (input.fs != output.fs) {
         fprintf(stderr, "エラー: サンプリング周波数が一致しません\n");
-        free(input_samples);
-        free(output_samples);
+        wav_reader_close(&input);
+        wav_reader_close(&output);
         return 1;
     }
+    if (input.channels != 1) {
+        fprintf(stderr, "エラー: 入力信号はモノラルである必要があります（%d ch）\n", input.channels);
+        wav_reader_close(&input);
+        wav_reader_close(&output);
+        return 1;
+    }
+    int fs = input.fs;
+    // 録音が多チャンネルの場合はチャンネルごとに独立したフィルタを推定する
+    int channels = output.channels;
+    if (channels > 1) printf("チャンネル数: %d（チャンネルごとにIRを推定）\n", channels);
 
     // 信号長を統一（短い方に合わせる）
-    int min_len = (input_len < output_len) ? input_len : output_len;
-    printf("処理長: %d サンプル (%.3f 秒)\n", min_len, (double)min_len / fs_input);
+    int64_t min_len = (input.num_frames < output.num_frames) ? input.num_frames : output.num_frames;
+    printf("処理長: %lld サンプル (%.3f 秒)\n", (long long)min_len, (double)min_len / fs);
 
-    // 3. 信号をdouble配列に変換
-    double *x = (double *)malloc(min_len * sizeof(double));
-    double *y = (double *)malloc(min_len * sizeof(double));
-    for (int i = 0; i < min_len; i++) {
-        x[i] = (double)input_samples[i] / 32768.0;
-        y[i] = (double)output_samples[i] / 32768.0;
-    }
-
-    // 4. NLMS適応フィルタを実行
-    double *h = (double *)calloc(filter_len, sizeof(double));
+    // 3. NLMS適応フィルタを実行（ブロックごとに読み込み、実数に変換して処理）
     double mu = 0.1;      // ステップサイズ
     double beta = 1e-6;   // 正則化パラメータ
 
+    // ファイルの形式によらず -1.0〜1.0 の実数として読み込む
+    // 録音はチャンネルごとの配列に分けて読み、入力信号は全チャンネルで共有する
+    float *xf = (float *)malloc(NLMS_BLOCK * sizeof(float));
+    float **yf = (float **)malloc(channels * sizeof(float *));
+    // 係数は選んだ精度の配列だけを持ち、出力時に1チャンネル分ずつ変換する
+    double *x = NULL, *y = NULL;
+    double **h = NULL, **x_buf = NULL;
+    float **hf = NULL, **x_buf_f = NULL;
+    if (use_float) {
+        hf = (float **)malloc(channels * sizeof(float *));
+        x_buf_f = (float **)malloc(channels * sizeof(float *));
+    } else {
+        x = (double *)malloc(NLMS_BLOCK * sizeof(double));
+        y = (double *)malloc(NLMS_BLOCK * sizeof(double));
+        h = (double **)malloc(channels * sizeof(double *));
+        x_buf = (double **)malloc(channels * sizeof(double *));
+    }
+    for (int c = 0; c < channels; c++) {
+        yf[c] = (float *)malloc(NLMS_BLOCK * sizeof(float));
+        if (use_float) {
+            hf[c] = (float *)calloc(filter_len, sizeof(float));
+            x_buf_f[c] = (float *)calloc(filter_len, sizeof(float));
+        } else {
+            h[c] = (double *)calloc(filter_len, sizeof(double));
+            x_buf[c] = (double *)calloc(filter_len, sizeof(double));
+        }
+    }
+
     printf("\n適応フィルタを実行中...\n");
-    nlms_adaptive_filter(x, y, min_len, filter_len, h, mu, beta);
+    int status = 0;
+    for (int64_t done = 0; done < min_len; ) {
+        int n = (min_len - done < NLMS_BLOCK) ? (int)(min_len - done) : NLMS_BLOCK;
+        if (wav_reader_read_float(&input, xf, n) != n ||
+            wav_reader_read_planar(&output, yf, n) != n) {
+            status = -1;
+            break;
+        }
+        if (use_float) {
+            for (int c = 0; c < channels; c++) {
+                nlms_adaptive_filter_float(xf, yf[c], n, filter_len, hf[c], x_buf_f[c], (float)mu, (float)beta);
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                x[i] = xf[i];
+            }
+            for (int c = 0; c < channels; c++) {
+                for (int i = 0; i < n; i++) {
+                    y[i] = yf[c][i];
+                }
+                nlms_adaptive_filter(x, y, n, filter_len, h[c], x_buf[c], mu, beta);
+            }
+        }
+        done += n;
+    }
+    wav_reader_close(&input);
+    wav_reader_close(&output);
+    for (int c = 0; c < channels; c++) {
+        free(yf[c]);
+        if (use_float) {
+            free(x_buf_f[c]);
+        } else {
+            free(x_buf[c]);
+        }
+    }
+    free(x);
+    free(y);
+    free(x_buf);
+    free(xf);
+    free(yf);
+    free(x_buf_f);
+    if (status < 0) {
+        fprintf(stderr, "エラー: 信号の読み込みに失敗\n");
+        free_filters(h, hf, channels);
+        return 1;
+    }
     printf("完了\n");
 
-    // 5. 最大値で正規化してWAV出力
+    // 4. 最大値で正規化してWAV出力
+    // チャンネル間のレベル差を保つため、全チャンネル共通の最大値で正規化する
     double max_amp = 0;
-    for (int i = 0; i < filter_len; i++) {
-        double amp = fabs(h[i]);
-        if (amp > max_amp) max_amp = amp;
+    for (int c = 0; c < channels; c++) {
+        for (int i = 0; i < filter_len; i++) {
+            double amp = fabs(use_float ? (double)hf[c][i] : h[c][i]);
+            if (amp > max_amp) max_amp = amp;
+        }
     }
 
-    int16_t *ir_samples = (int16_t *)malloc(filter_len * sizeof(int16_t));
-    for (int i = 0; i < filter_len; i++) {
-        double sample = h[i] / max_amp * 0.9;
-        ir_samples[i] = (int16_t)(sample * 32767.0);
-    }
+    // モノラルは指定どおりのファイル名、多チャンネルは "_ch1" などを付けてチャンネルごとに保存
+    float *ir_samples = (float *)malloc(filter_len * sizeof(float));
+    for (int c = 0; c < channels && status == 0; c++) {
+        for (int i = 0; i < filter_len; i++) {
+            double v = use_float ? (double)hf[c][i] : h[c][i];
+            ir_samples[i] = (float)(v / max_amp * 0.9);
+        }
 
-    if (write_wav(ir_output, ir_samples, filter_len, fs_input) < 0) {
-        fprintf(stderr, "エラー: WAVファイルの書き込みに失敗\n");
-        free(input_samples);
-        free(output_samples);
-        free(x);
-        free(y);
-        free(h);
-        free(ir_samples);
-        return 1;
+        char path[4096];
+        const char *ir_file = ir_output;
+        if (channels > 1) {
+            if (wav_channel_path(path, sizeof(path), ir_output, c) < 0) {
+                status = -1;
+                break;
+            }
+            ir_file = path;
+        }
+        if (write_wav_float(ir_file, ir_samples, filter_len, fs, out_format) < 0) {
+            fprintf(stderr, "エラー: WAVファイルの書き込みに失敗\n");
+            status = -1;
+            break;
+        }
+        printf("\n完了: %s を保存しました。\n", ir_file);
+    }
+    if (status == 0) {
+        printf("インパルス応答長: %d サンプル (%.3f 秒)\n", filter_len, (double)filter_len / fs);
     }
-
-    printf("\n完了: %s を保存しました。\n", ir_output);
-    printf("インパルス応答長: %d サンプル (%.3f 秒)\n", filter_len, (double)filter_len / fs_input);
 
     // メモリ解放
-    free(input_samples);
-    free(output_samples);
-    free(x);
-    free(y);
-    free(h);
+    free_filters(h, hf, channels);
     free(ir_samples);
 
-    return 0;
+    return (status == 0) ? 0 : 1;
 }
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <complex.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "fft.h"
+#include "parallel.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * 2のべき乗でない長さは、2/3/4/5/7 の積に分解できれば混合基数の
+ * Stockham 自動整列FFT（ビット反転不要、作業領域と交互に読み書き）で、
+ * それ以外は Bluestein 法（2のべき乗FFTによる畳み込み）で計算する。
+ */
+
+/*
+ * 長い変換（n >= FFT_BLOCKED_MIN_N）は段ごとに配列全体を往復すると
+ * L2/L3 キャッシュから溢れてメモリ帯域律速になるため、n = n1 * n2 の
+ * 行列とみなす four-step 法で計算する:
+ *   1. 列方向の n1 点FFT（FFT_COLUMN_BLOCK 列ずつ作業領域に集めて計算）と回転因子
+ *   2. 行方向の n2 点FFT
+ *   3. 転置して自然順に並べる
+ * 各FFTはキャッシュに収まる長さで行い、配列全体の読み書きは3往復で済む。
+ * 各パスは互いに独立な列・行ブロックの集まりなので、複数スレッドで分担する。
+ */
+#ifndef FFT_BLOCKED_MIN_N
+#define FFT_BLOCKED_MIN_N (1 << 20)
+#endif
+
+#define FFT_COLUMN_BLOCK 16
+
+// 作業領域の行間隔に足す余白（2のべき乗間隔によるキャッシュのセット競合を避ける）
+#define FFT_BLOCK_PAD 8
+
+// 列の収集・書き戻しで何行先をプリフェッチするか
+#define FFT_PREFETCH_ROWS 8
+
+// 大きな変換で使うスレッド数（fft_set_threads で設定）
+static atomic_int fft_num_threads = 1;
+
+void fft_set_threads(int num_threads) {
+    if (num_threads <= 0) num_threads = parallel_num_cpus();
+    atomic_store(&fft_num_threads, num_threads);
+}
+
+int fft_get_threads(void) {
+    return atomic_load(&fft_num_threads);
+}
+
+static int is_power_of_two(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+/**
+ * 2, 3, 5, 7 以外の素因数を持たないか
+ */
+static int is_smooth(int n) {
+    static const int primes[] = { 2, 3, 5, 7 };
+    for (int i = 0; i < 4; i++) {
+        while (n % primes[i] == 0) n /= primes[i];
+    }
+    return n == 1;
+}
+
+int fft_next_fast_size(int n) {
+    if (n <= 1) return 1;
+    while (!is_smooth(n)) n++;
+    return n;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FFT_HAVE_AVX2 1
+#endif
+
+/*
+ * 倍精度版（fft_plan, fft_execute, ...）
+ */
+#define FFT_REAL double
+#define FFT_COMPLEX double complex
+#define FFT_PLAN fft_plan
+#define FFT_FN(name) name
+#define FFT_CREAL creal
+#define FFT_CIMAG cimag
+#define FFT_CONJ conj
+#define FFT_VEC __m256d
+#define FFT_VLEN 4
+#define FFT_VLOAD _mm256_loadu_pd
+#define FFT_VSTORE _mm256_storeu_pd
+#define FFT_VADD _mm256_add_pd
+#define FFT_VSUB _mm256_sub_pd
+#define FFT_VMUL _mm256_mul_pd
+#define FFT_VFMADD _mm256_fmadd_pd
+#define FFT_VFMSUB _mm256_fmsub_pd
+#include "fft_impl.h"
+
+/*
+ * 単精度版（fft_planf, fft_executef, ...）
+ * ベクトル幅が倍になり、メモリ転送量は半分になる。
+ */
+#define FFT_REAL float
+#define FFT_COMPLEX float complex
+#define FFT_PLAN fft_planf
+#define FFT_FN(name) name##f
+#define FFT_CREAL crealf
+#define FFT_CIMAG cimagf
+#define FFT_CONJ conjf
+#define FFT_VEC __m256
+#define FFT_VLEN 8
+#define FFT_VLOAD _mm256_loadu_ps
+#define FFT_VSTORE _mm256_storeu_ps
+#define FFT_VADD _mm256_add_ps
+#define FFT_VSUB _mm256_sub_ps
+#define FFT_VMUL _mm256_mul_ps
+#define FFT_VFMADD _mm256_fmadd_ps
+#define FFT_VFMSUB _mm256_fmsub_ps
+#include "fft_impl.h"
@@ -0,0 +1,90 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex.h>
+
+/*
+ * FFTプラン
+ * ビット反転表と回転因子表を生成時に一度だけ計算し、同じ長さの変換で使い回す。
+ * 符号規約は従来の simple_fft / simple_ifft と同じ:
+ *   順変換: X[k] = Σ x[n] exp(+j2πkn/N)
+ *   逆変換: x[n] = (1/N) Σ X[k] exp(-j2πkn/N)
+ * プランは生成後に書き換えないため、複数の変換で共有できる。
+ */
+typedef struct fft_plan fft_plan;
+
+#define FFT_FORWARD  1
+#define FFT_INVERSE -1
+
+/**
+ * n 点複素FFTのプランを生成
+ * 2のべき乗が最速で、2, 3, 5, 7 の積の長さは混合基数、
+ * それ以外の長さは Bluestein 法で計算する。
+ * 戻り値: プラン、エラー時はNULL
+ */
+fft_plan *fft_plan_create(int n);
+
+/**
+ * n 点実数FFTのプランを生成（n は偶数）
+ * fft_execute_r2c / fft_execute_c2r で使用する。
+ * 戻り値: プラン、エラー時はNULL
+ */
+fft_plan *fft_plan_create_real(int n);
+
+/**
+ * n 以上で最小の高速な変換長（2, 3, 5, 7 の積）を返す
+ */
+int fft_next_fast_size(int n);
+
+/**
+ * 複素FFTを実行（x を上書き）
+ * direction: FFT_FORWARD または FFT_INVERSE（1/N で正規化）
+ */
+void fft_execute(const fft_plan *plan, double complex *x, int direction);
+
+/**
+ * 実数入力FFTを実行
+ * X を double 配列とみなした先頭 n 要素に実数信号を格納して呼び出すと、
+ * 0〜n/2 の n/2+1 ビンのスペクトルが X に格納される。
+ */
+void fft_execute_r2c(const fft_plan *plan, double complex *X);
+
+/**
+ * 実数出力IFFTを実行（fft_execute_r2c の逆変換）
+ * X に 0〜n/2 の n/2+1 ビンを与えると、X を double 配列とみなした
+ * 先頭 n 要素に実数信号が得られる。
+ */
+void fft_execute_c2r(const fft_plan *plan, double complex *X);
+
+/**
+ * 大きな変換（four-step 法を使う長さ）で使うスレッド数を設定
+ * 0 以下を指定すると利用可能なCPUコア数を使う。既定値は1。
+ */
+void fft_set_threads(int num_threads);
+
+/**
+ * 現在のスレッド数を取得
+ */
+int fft_get_threads(void);
+
+/**
+ * プランを解放
+ */
+void fft_plan_destroy(fft_plan *plan);
+
+/*
+ * 単精度版（float / float complex）
+ * 使い方・符号規約は倍精度版と同じで、関数名の末尾に f が付く。
+ * 回転因子は倍精度で計算してから丸めるため、誤差は float の丸め程度
+ * （相対 1e-6 程度）に収まる。
+ */
+typedef struct fft_planf fft_planf;
+
+fft_planf *fft_plan_createf(int n);
+fft_planf *fft_plan_create_realf(int n);
+void fft_executef(const fft_planf *plan, float complex *x, int direction);
+void fft_execute_r2cf(const fft_planf *plan, float complex *X);
+void fft_execute_c2rf(const fft_planf *plan, float complex *X);
+void fft_plan_destroyf(fft_planf *plan);
+
+#endif
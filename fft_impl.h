@@ -0,0 +1,865 @@
+/*
+ * FFT本体（fft.c から精度ごとに2回インクルードする）
+ * インクルード前に以下を定義しておく:
+ *   FFT_REAL, FFT_COMPLEX     実数型・複素数型（double / float）
+ *   FFT_PLAN                  プラン型名（fft_plan / fft_planf）
+ *   FFT_FN(name)              関数名（float 版は末尾に f を付ける）
+ *   FFT_CREAL, FFT_CIMAG, FFT_CONJ   複素数の実部・虚部・共役
+ *   FFT_VEC, FFT_VLEN, FFT_VLOAD ...  AVX2 のベクトル型・要素数・演算
+ * 回転因子は double で計算してから FFT_REAL に丸めて保持する。
+ */
+
+/*
+ * 内部ではデータを実部/虚部の別配列（SoA）に並べ替えて計算する。
+ * バタフライは2段分をまとめた radix-4 (2x2) で、AVX2/FMA が使える
+ * CPUでは1レジスタ分（double は4要素、float は8要素）ずつベクトル化したカーネルを実行時に選択する。
+ * 逆変換は conj(FFT(conj(x))) / N として同じカーネルで計算する。
+ */
+typedef void (*FFT_FN(fft_stage_func))(FFT_REAL *re, FFT_REAL *im, int n, int m,
+                               const FFT_REAL *tw_re, const FFT_REAL *tw_im);
+
+struct FFT_PLAN {
+    int n;                      // 変換長（実数プランでは実数信号の長さ）
+    int *bitrev;                // ビット反転並べ替え表
+    FFT_REAL *tw_re;            // 段ごとの回転因子表（実部）: tw[len/2 + j] = exp(+j2πj/len)
+    FFT_REAL *tw_im;            // 同（虚部）
+    FFT_FN(fft_stage_func) radix4_stage; // radix-4 段のカーネル（CPUに応じて選択）
+    FFT_PLAN *row1;             // four-step用: n1 点プラン
+    FFT_PLAN *row2;             // four-step用: n2 点プラン
+    FFT_COMPLEX *tw_lo;         // four-step用: exp(+j2πe/n), e = 0〜n1-1
+    FFT_COMPLEX *tw_hi;         // four-step用: exp(+j2πe*n1/n), e = 0〜n2-1
+    FFT_REAL *work;             // 作業領域（初回使用時に確保し、以降は使い回す）
+    atomic_flag work_busy;      // 作業領域の使用中フラグ
+    int num_radices;            // 混合基数用: 段数（0 なら混合基数プランではない）
+    int radices[32];            // 混合基数用: 各段の基数（4, 2, 3, 5, 7）
+    FFT_COMPLEX *mixed_tw;      // 混合基数用: 各段の回転因子 exp(+j2π p u / len)
+    FFT_PLAN *conv;             // Bluestein用: 畳み込みに使う2のべき乗プラン
+    FFT_COMPLEX *chirp;         // Bluestein用: exp(+jπ k^2 / n), k = 0〜n-1
+    FFT_COMPLEX *chirp_fft;     // Bluestein用: conj(chirp) を並べた系列のFFT
+    FFT_PLAN *half;             // 実数プラン用: n/2 点複素プラン
+    FFT_COMPLEX *real_twiddle;  // 実数プラン用: exp(+j2πk/n), k = 0〜n/4
+};
+
+/**
+ * 先頭の radix-2 段（len = 2、回転因子は1）
+ * log2(n) が奇数のときだけ使う。
+ */
+static void FFT_FN(radix2_first_stage)(FFT_REAL *re, FFT_REAL *im, int n) {
+    for (int i = 0; i < n; i += 2) {
+        FFT_REAL ur = re[i], ui = im[i];
+        FFT_REAL vr = re[i + 1], vi = im[i + 1];
+        re[i] = ur + vr; im[i] = ui + vi;
+        re[i + 1] = ur - vr; im[i + 1] = ui - vi;
+    }
+}
+
+/**
+ * radix-4 段（スカラー版）
+ * len = 2m と len = 4m の radix-2 段2つを1回の読み書きで処理する。
+ * w1 = exp(+j2πj/2m), w2 = exp(+j2πj/4m)、
+ * (j+m, j+3m) の組の回転因子 w2 * exp(+jπ/2) は j 倍で済ませる。
+ */
+static void FFT_FN(radix4_stage_scalar)(FFT_REAL *re, FFT_REAL *im, int n, int m,
+                                const FFT_REAL *tw_re, const FFT_REAL *tw_im) {
+    const FFT_REAL *w1r = tw_re + m, *w1i = tw_im + m;
+    const FFT_REAL *w2r = tw_re + 2 * m, *w2i = tw_im + 2 * m;
+    for (int i = 0; i < n; i += 4 * m) {
+        FFT_REAL *r0 = re + i, *r1 = r0 + m, *r2 = r1 + m, *r3 = r2 + m;
+        FFT_REAL *i0 = im + i, *i1 = i0 + m, *i2 = i1 + m, *i3 = i2 + m;
+        for (int j = 0; j < m; j++) {
+            FFT_REAL t1r = w1r[j] * r1[j] - w1i[j] * i1[j];
+            FFT_REAL t1i = w1r[j] * i1[j] + w1i[j] * r1[j];
+            FFT_REAL t3r = w1r[j] * r3[j] - w1i[j] * i3[j];
+            FFT_REAL t3i = w1r[j] * i3[j] + w1i[j] * r3[j];
+            FFT_REAL b0r = r0[j] + t1r, b0i = i0[j] + t1i;
+            FFT_REAL b1r = r0[j] - t1r, b1i = i0[j] - t1i;
+            FFT_REAL b2r = r2[j] + t3r, b2i = i2[j] + t3i;
+            FFT_REAL b3r = r2[j] - t3r, b3i = i2[j] - t3i;
+            FFT_REAL ur = w2r[j] * b2r - w2i[j] * b2i;
+            FFT_REAL ui = w2r[j] * b2i + w2i[j] * b2r;
+            FFT_REAL vr = w2r[j] * b3r - w2i[j] * b3i;
+            FFT_REAL vi = w2r[j] * b3i + w2i[j] * b3r;
+            r0[j] = b0r + ur; i0[j] = b0i + ui;
+            r2[j] = b0r - ur; i2[j] = b0i - ui;
+            r1[j] = b1r - vi; i1[j] = b1i + vr;
+            r3[j] = b1r + vi; i3[j] = b1i - vr;
+        }
+    }
+}
+
+
+#ifdef FFT_HAVE_AVX2
+/**
+ * radix-4 段（AVX2/FMA版、m は FFT_VLEN の倍数）
+ */
+__attribute__((target("avx2,fma")))
+static void FFT_FN(radix4_stage_avx2)(FFT_REAL *re, FFT_REAL *im, int n, int m,
+                              const FFT_REAL *tw_re, const FFT_REAL *tw_im) {
+    const FFT_REAL *w1r = tw_re + m, *w1i = tw_im + m;
+    const FFT_REAL *w2r = tw_re + 2 * m, *w2i = tw_im + 2 * m;
+    for (int i = 0; i < n; i += 4 * m) {
+        FFT_REAL *r0 = re + i, *r1 = r0 + m, *r2 = r1 + m, *r3 = r2 + m;
+        FFT_REAL *i0 = im + i, *i1 = i0 + m, *i2 = i1 + m, *i3 = i2 + m;
+        for (int j = 0; j < m; j += FFT_VLEN) {
+            FFT_VEC ar1 = FFT_VLOAD(r1 + j), ai1 = FFT_VLOAD(i1 + j);
+            FFT_VEC ar3 = FFT_VLOAD(r3 + j), ai3 = FFT_VLOAD(i3 + j);
+            FFT_VEC wr = FFT_VLOAD(w1r + j), wi = FFT_VLOAD(w1i + j);
+
+            FFT_VEC t1r = FFT_VFMSUB(wr, ar1, FFT_VMUL(wi, ai1));
+            FFT_VEC t1i = FFT_VFMADD(wr, ai1, FFT_VMUL(wi, ar1));
+            FFT_VEC t3r = FFT_VFMSUB(wr, ar3, FFT_VMUL(wi, ai3));
+            FFT_VEC t3i = FFT_VFMADD(wr, ai3, FFT_VMUL(wi, ar3));
+
+            FFT_VEC ar0 = FFT_VLOAD(r0 + j), ai0 = FFT_VLOAD(i0 + j);
+            FFT_VEC ar2 = FFT_VLOAD(r2 + j), ai2 = FFT_VLOAD(i2 + j);
+            FFT_VEC b0r = FFT_VADD(ar0, t1r), b0i = FFT_VADD(ai0, t1i);
+            FFT_VEC b1r = FFT_VSUB(ar0, t1r), b1i = FFT_VSUB(ai0, t1i);
+            FFT_VEC b2r = FFT_VADD(ar2, t3r), b2i = FFT_VADD(ai2, t3i);
+            FFT_VEC b3r = FFT_VSUB(ar2, t3r), b3i = FFT_VSUB(ai2, t3i);
+
+            wr = FFT_VLOAD(w2r + j);
+            wi = FFT_VLOAD(w2i + j);
+            FFT_VEC ur = FFT_VFMSUB(wr, b2r, FFT_VMUL(wi, b2i));
+            FFT_VEC ui = FFT_VFMADD(wr, b2i, FFT_VMUL(wi, b2r));
+            FFT_VEC vr = FFT_VFMSUB(wr, b3r, FFT_VMUL(wi, b3i));
+            FFT_VEC vi = FFT_VFMADD(wr, b3i, FFT_VMUL(wi, b3r));
+
+            FFT_VSTORE(r0 + j, FFT_VADD(b0r, ur));
+            FFT_VSTORE(i0 + j, FFT_VADD(b0i, ui));
+            FFT_VSTORE(r2 + j, FFT_VSUB(b0r, ur));
+            FFT_VSTORE(i2 + j, FFT_VSUB(b0i, ui));
+            FFT_VSTORE(r1 + j, FFT_VSUB(b1r, vi));
+            FFT_VSTORE(i1 + j, FFT_VADD(b1i, vr));
+            FFT_VSTORE(r3 + j, FFT_VADD(b1r, vi));
+            FFT_VSTORE(i3 + j, FFT_VSUB(b1i, vr));
+        }
+    }
+}
+#endif
+
+
+/**
+ * SoA データに対して全段を実行（入力はビット反転順、順変換）
+ */
+static void FFT_FN(fft_stages)(const FFT_PLAN *plan, FFT_REAL *re, FFT_REAL *im) {
+    int n = plan->n;
+    int m = 1;
+    // log2(n) が奇数なら radix-2 段を1つ挟んで残りを radix-4 にする
+    if (n >= 2 && (__builtin_ctz(n) & 1)) {
+        FFT_FN(radix2_first_stage)(re, im, n);
+        m = 2;
+    }
+    for (; 4 * m <= n; m *= 4) {
+        if (m >= FFT_VLEN) {
+            plan->radix4_stage(re, im, n, m, plan->tw_re, plan->tw_im);
+        } else {
+            FFT_FN(radix4_stage_scalar)(re, im, n, m, plan->tw_re, plan->tw_im);
+        }
+    }
+}
+
+/**
+ * 作業領域を取得
+ * プランに保持した領域が空いていればそれを使い、他の変換が使用中なら
+ * 新たに確保する（同じプランを複数スレッドから同時に実行してもよい）。
+ */
+static FFT_REAL *FFT_FN(fft_work_acquire)(const FFT_PLAN *plan, size_t len, int *owned) {
+    FFT_PLAN *p = (FFT_PLAN *)plan;
+    FFT_REAL *work = NULL;
+    *owned = 0;
+    if (!atomic_flag_test_and_set(&p->work_busy)) {
+        if (!p->work) p->work = (FFT_REAL *)malloc(len * sizeof(FFT_REAL));
+        if (p->work) {
+            *owned = 1;
+            work = p->work;
+        } else {
+            atomic_flag_clear(&p->work_busy);
+        }
+    }
+    if (!work) work = (FFT_REAL *)malloc(len * sizeof(FFT_REAL));
+    if (!work) {
+        fprintf(stderr, "エラー: FFT作業領域の確保に失敗\n");
+        exit(1);
+    }
+    return work;
+}
+
+/**
+ * 作業領域を返却
+ */
+static void FFT_FN(fft_work_release)(const FFT_PLAN *plan, FFT_REAL *work, int owned) {
+    if (owned) {
+        atomic_flag_clear(&((FFT_PLAN *)plan)->work_busy);
+    } else {
+        free(work);
+    }
+}
+
+/*
+ * four-step 法の各パスで共有する情報
+ * 各パスは列ブロック・行ブロック単位で独立しているため、parallel_for で
+ * スレッドに分割する。作業ブロックはスレッドごとに確保する。
+ */
+typedef struct {
+    const FFT_PLAN *plan;
+    FFT_COMPLEX *x;             // 入出力（n1 行 n2 列）
+    FFT_COMPLEX *out;           // 非正方の場合の転置先
+    FFT_REAL sign;              // -1 のとき入力と出力の共役を取る（逆変換）
+    FFT_REAL scale;             // 出力に掛ける係数
+} FFT_FN(fft_blocked_ctx);
+
+static FFT_REAL *FFT_FN(fft_block_alloc)(int len) {
+    FFT_REAL *block = (FFT_REAL *)malloc(2 * (size_t)FFT_COLUMN_BLOCK * (len + FFT_BLOCK_PAD) * sizeof(FFT_REAL));
+    if (!block) {
+        fprintf(stderr, "エラー: FFT作業領域の確保に失敗\n");
+        exit(1);
+    }
+    return block;
+}
+
+/**
+ * パス1: 列ごとに n1 点FFT、回転因子 exp(+j2π c k1 / n) を掛ける
+ * begin〜end は列ブロックの番号。
+ */
+static void FFT_FN(fft_blocked_columns)(void *arg, int begin, int end) {
+    const FFT_FN(fft_blocked_ctx) *ctx = (const FFT_FN(fft_blocked_ctx) *)arg;
+    const FFT_PLAN *plan = ctx->plan;
+    const FFT_PLAN *p1 = plan->row1;
+    FFT_COMPLEX *x = ctx->x;
+    int n1 = p1->n;
+    int n2 = plan->row2->n;
+    int log_n1 = __builtin_ctz(n1);
+    int ld1 = n1 + FFT_BLOCK_PAD;
+    FFT_REAL *block_re = FFT_FN(fft_block_alloc)(n1);
+    FFT_REAL *block_im = block_re + (size_t)FFT_COLUMN_BLOCK * ld1;
+
+    for (int blk = begin; blk < end; blk++) {
+        int c0 = blk * FFT_COLUMN_BLOCK;
+        // 列をビット反転順に SoA の行として集める
+        for (int r = 0; r < n1; r++) {
+            const FFT_COMPLEX *src = x + (size_t)r * n2 + c0;
+            if (r + FFT_PREFETCH_ROWS < n1) {
+                const FFT_COMPLEX *next = src + (size_t)FFT_PREFETCH_ROWS * n2;
+                for (int c = 0; c < FFT_COLUMN_BLOCK; c += 4) __builtin_prefetch(next + c);
+            }
+            int rr = p1->bitrev[r];
+            for (int c = 0; c < FFT_COLUMN_BLOCK; c++) {
+                block_re[c * ld1 + rr] = FFT_CREAL(src[c]);
+                block_im[c * ld1 + rr] = ctx->sign * FFT_CIMAG(src[c]);
+            }
+        }
+        for (int c = 0; c < FFT_COLUMN_BLOCK; c++) {
+            FFT_REAL *row_re = block_re + c * ld1;
+            FFT_REAL *row_im = block_im + c * ld1;
+            FFT_FN(fft_stages)(p1, row_re, row_im);
+            for (int k = 1; k < n1; k++) {
+                int e = (c0 + c) * k; // < n
+                FFT_COMPLEX hi = plan->tw_hi[e >> log_n1];
+                FFT_COMPLEX lo = plan->tw_lo[e & (n1 - 1)];
+                FFT_REAL wr = FFT_CREAL(hi) * FFT_CREAL(lo) - FFT_CIMAG(hi) * FFT_CIMAG(lo);
+                FFT_REAL wi = FFT_CREAL(hi) * FFT_CIMAG(lo) + FFT_CIMAG(hi) * FFT_CREAL(lo);
+                FFT_REAL vr = row_re[k], vi = row_im[k];
+                row_re[k] = vr * wr - vi * wi;
+                row_im[k] = vr * wi + vi * wr;
+            }
+        }
+        for (int r = 0; r < n1; r++) {
+            FFT_COMPLEX *dst = x + (size_t)r * n2 + c0;
+            if (r + FFT_PREFETCH_ROWS < n1) {
+                FFT_COMPLEX *next = dst + (size_t)FFT_PREFETCH_ROWS * n2;
+                for (int c = 0; c < FFT_COLUMN_BLOCK; c += 4) __builtin_prefetch(next + c, 1);
+            }
+            for (int c = 0; c < FFT_COLUMN_BLOCK; c++) {
+                dst[c] = block_re[c * ld1 + r] + I * block_im[c * ld1 + r];
+            }
+        }
+    }
+    free(block_re);
+}
+
+/**
+ * パス2: 行ごとに n2 点FFT
+ * 正方行列なら行に書き戻し、そうでなければ out へ転置しながら書き出す。
+ * begin〜end は行ブロックの番号。
+ */
+static void FFT_FN(fft_blocked_rows)(void *arg, int begin, int end) {
+    const FFT_FN(fft_blocked_ctx) *ctx = (const FFT_FN(fft_blocked_ctx) *)arg;
+    const FFT_PLAN *p2 = ctx->plan->row2;
+    FFT_COMPLEX *x = ctx->x;
+    int n1 = ctx->plan->row1->n;
+    int n2 = p2->n;
+    int ld2 = n2 + FFT_BLOCK_PAD;
+    FFT_REAL sign = ctx->sign, scale = ctx->scale;
+    FFT_REAL *block_re = FFT_FN(fft_block_alloc)(n2);
+    FFT_REAL *block_im = block_re + (size_t)FFT_COLUMN_BLOCK * ld2;
+
+    for (int blk = begin; blk < end; blk++) {
+        int r0 = blk * FFT_COLUMN_BLOCK;
+        for (int r = 0; r < FFT_COLUMN_BLOCK; r++) {
+            const FFT_COMPLEX *src = x + (size_t)(r0 + r) * n2;
+            FFT_REAL *row_re = block_re + r * ld2;
+            FFT_REAL *row_im = block_im + r * ld2;
+            for (int c = 0; c < n2; c++) {
+                int cc = p2->bitrev[c];
+                row_re[cc] = FFT_CREAL(src[c]);
+                row_im[cc] = FFT_CIMAG(src[c]);
+            }
+            FFT_FN(fft_stages)(p2, row_re, row_im);
+        }
+        if (!ctx->out) {
+            for (int r = 0; r < FFT_COLUMN_BLOCK; r++) {
+                FFT_COMPLEX *dst = x + (size_t)(r0 + r) * n2;
+                for (int c = 0; c < n2; c++) {
+                    dst[c] = scale * block_re[r * ld2 + c] + I * (sign * scale * block_im[r * ld2 + c]);
+                }
+            }
+        } else {
+            for (int c = 0; c < n2; c++) {
+                FFT_COMPLEX *dst = ctx->out + (size_t)c * n1 + r0;
+                for (int r = 0; r < FFT_COLUMN_BLOCK; r++) {
+                    dst[r] = scale * block_re[r * ld2 + c] + I * (sign * scale * block_im[r * ld2 + c]);
+                }
+            }
+        }
+    }
+    free(block_re);
+}
+
+/**
+ * パス3: 自然順 k = k1 + n1 * k2 に並べる
+ * 正方行列はタイル単位の in-place 転置（タイル行 begin〜end を担当）、
+ * 非正方は out から x へ行 begin〜end をコピーする。
+ */
+static void FFT_FN(fft_blocked_transpose)(void *arg, int begin, int end) {
+    const FFT_FN(fft_blocked_ctx) *ctx = (const FFT_FN(fft_blocked_ctx) *)arg;
+    FFT_COMPLEX *x = ctx->x;
+    int n1 = ctx->plan->row1->n;
+    int n2 = ctx->plan->row2->n;
+
+    if (ctx->out) {
+        memcpy(x + (size_t)begin * n1, ctx->out + (size_t)begin * n1,
+               (size_t)(end - begin) * n1 * sizeof(FFT_COMPLEX));
+        return;
+    }
+    for (int blk = begin; blk < end; blk++) {
+        int r0 = blk * FFT_COLUMN_BLOCK;
+        for (int c0 = r0; c0 < n2; c0 += FFT_COLUMN_BLOCK) {
+            for (int r = r0; r < r0 + FFT_COLUMN_BLOCK; r++) {
+                for (int c = (c0 == r0) ? r + 1 : c0; c < c0 + FFT_COLUMN_BLOCK; c++) {
+                    FFT_COMPLEX t = x[(size_t)r * n1 + c];
+                    x[(size_t)r * n1 + c] = x[(size_t)c * n1 + r];
+                    x[(size_t)c * n1 + r] = t;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * four-step 法による複素FFT
+ * x を n1 行 n2 列の行列 x[r * n2 + c] とみなす。
+ */
+static void FFT_FN(fft_execute_blocked)(const FFT_PLAN *plan, FFT_COMPLEX *x,
+                                FFT_REAL sign, FFT_REAL scale) {
+    int n1 = plan->row1->n;
+    int n2 = plan->row2->n;
+    int threads = fft_get_threads();
+
+    FFT_FN(fft_blocked_ctx) ctx;
+    ctx.plan = plan;
+    ctx.x = x;
+    ctx.out = NULL;
+    ctx.sign = sign;
+    ctx.scale = scale;
+
+    int owned = 0;
+    if (n1 != n2) {
+        ctx.out = (FFT_COMPLEX *)FFT_FN(fft_work_acquire)(plan, 2 * (size_t)plan->n, &owned);
+    }
+
+    parallel_for(n2 / FFT_COLUMN_BLOCK, threads, FFT_FN(fft_blocked_columns), &ctx);
+    parallel_for(n1 / FFT_COLUMN_BLOCK, threads, FFT_FN(fft_blocked_rows), &ctx);
+    if (ctx.out) {
+        parallel_for(n2, threads, FFT_FN(fft_blocked_transpose), &ctx);
+        FFT_FN(fft_work_release)(plan, (FFT_REAL *)ctx.out, owned);
+    } else {
+        parallel_for(n1 / FFT_COLUMN_BLOCK, threads, FFT_FN(fft_blocked_transpose), &ctx);
+    }
+}
+
+/**
+ * four-step 用プランを生成
+ */
+static FFT_PLAN *FFT_FN(fft_plan_create_blocked)(int n) {
+    FFT_PLAN *p = (FFT_PLAN *)calloc(1, sizeof(FFT_PLAN));
+    if (!p) return NULL;
+    p->n = n;
+    atomic_flag_clear(&p->work_busy);
+
+    int log_n = __builtin_ctz(n);
+    int n1 = 1 << (log_n / 2);
+    int n2 = n / n1;
+    p->row1 = FFT_FN(fft_plan_create)(n1);
+    p->row2 = FFT_FN(fft_plan_create)(n2);
+    p->tw_lo = (FFT_COMPLEX *)malloc(n1 * sizeof(FFT_COMPLEX));
+    p->tw_hi = (FFT_COMPLEX *)malloc(n2 * sizeof(FFT_COMPLEX));
+    if (!p->row1 || !p->row2 || !p->tw_lo || !p->tw_hi) {
+        FFT_FN(fft_plan_destroy)(p);
+        return NULL;
+    }
+
+    // exp(+j2πe/n) を上位・下位の2表の積で表す（どちらも直接計算）
+    for (int e = 0; e < n1; e++) {
+        double ang = 2.0 * M_PI * e / n;
+        p->tw_lo[e] = cos(ang) + I * sin(ang);
+    }
+    for (int e = 0; e < n2; e++) {
+        double ang = 2.0 * M_PI * e / n2;
+        p->tw_hi[e] = cos(ang) + I * sin(ang);
+    }
+    return p;
+}
+
+
+/**
+ * 混合基数の1段（Stockham、周波数間引き）
+ * 長さ len = r * m の部分列 s 本を同時に処理する:
+ *   y[q + s(r p + u)] = (Σ_t x[q + s(p + t m)] exp(+j2π t u / r)) * exp(+j2π p u / len)
+ * tw には p = 0〜m-1, u = 1〜r-1 の回転因子が tw[p (r-1) + u - 1] の順に並ぶ。
+ */
+static inline __attribute__((always_inline))
+void FFT_FN(mixed_radix_stage)(int r, int m, int s,
+                       const FFT_REAL *restrict xr, const FFT_REAL *restrict xi,
+                       FFT_REAL *restrict yr, FFT_REAL *restrict yi,
+                       const FFT_COMPLEX *tw) {
+    FFT_REAL cos_t[7], sin_t[7];
+    for (int t = 0; t < r; t++) {
+        cos_t[t] = cos(2.0 * M_PI * t / r);
+        sin_t[t] = sin(2.0 * M_PI * t / r);
+    }
+
+    for (int p = 0; p < m; p++) {
+        const FFT_REAL *ar_p[7], *ai_p[7];
+        FFT_REAL *br_p[7], *bi_p[7];
+        FFT_REAL wr[7], wi[7];
+        for (int t = 0; t < r; t++) {
+            ar_p[t] = xr + (size_t)s * (p + t * m);
+            ai_p[t] = xi + (size_t)s * (p + t * m);
+            br_p[t] = yr + (size_t)s * (r * p + t);
+            bi_p[t] = yi + (size_t)s * (r * p + t);
+        }
+        wr[0] = 1.0; wi[0] = 0.0;
+        for (int u = 1; u < r; u++) {
+            wr[u] = FFT_CREAL(tw[p * (r - 1) + u - 1]);
+            wi[u] = FFT_CIMAG(tw[p * (r - 1) + u - 1]);
+        }
+
+        for (int q = 0; q < s; q++) {
+            FFT_REAL ar[7], ai[7], br[7], bi[7];
+            for (int t = 0; t < r; t++) {
+                ar[t] = ar_p[t][q];
+                ai[t] = ai_p[t][q];
+            }
+
+            // r 点DFT（exp(+j2πtu/r)）
+            if (r == 2) {
+                br[0] = ar[0] + ar[1]; bi[0] = ai[0] + ai[1];
+                br[1] = ar[0] - ar[1]; bi[1] = ai[0] - ai[1];
+            } else if (r == 4) {
+                FFT_REAL s0r = ar[0] + ar[2], s0i = ai[0] + ai[2];
+                FFT_REAL d0r = ar[0] - ar[2], d0i = ai[0] - ai[2];
+                FFT_REAL s1r = ar[1] + ar[3], s1i = ai[1] + ai[3];
+                FFT_REAL d1r = ar[1] - ar[3], d1i = ai[1] - ai[3];
+                br[0] = s0r + s1r; bi[0] = s0i + s1i;
+                br[2] = s0r - s1r; bi[2] = s0i - s1i;
+                br[1] = d0r - d1i; bi[1] = d0i + d1r;
+                br[3] = d0r + d1i; bi[3] = d0i - d1r;
+            } else {
+                // 奇数基数: t と r-t の組をまとめて乗算を半分にする
+                br[0] = ar[0]; bi[0] = ai[0];
+                for (int t = 1; t <= r / 2; t++) {
+                    br[0] += ar[t] + ar[r - t];
+                    bi[0] += ai[t] + ai[r - t];
+                }
+                for (int u = 1; u <= r / 2; u++) {
+                    FFT_REAL cr = ar[0], ci = ai[0], sr = 0.0, si = 0.0;
+                    for (int t = 1; t <= r / 2; t++) {
+                        int tu = (t * u) % r;
+                        cr += (ar[t] + ar[r - t]) * cos_t[tu];
+                        ci += (ai[t] + ai[r - t]) * cos_t[tu];
+                        sr += (ar[t] - ar[r - t]) * sin_t[tu];
+                        si += (ai[t] - ai[r - t]) * sin_t[tu];
+                    }
+                    br[u] = cr - si;     bi[u] = ci + sr;
+                    br[r - u] = cr + si; bi[r - u] = ci - sr;
+                }
+            }
+
+            br_p[0][q] = br[0];
+            bi_p[0][q] = bi[0];
+            for (int u = 1; u < r; u++) {
+                br_p[u][q] = br[u] * wr[u] - bi[u] * wi[u];
+                bi_p[u][q] = br[u] * wi[u] + bi[u] * wr[u];
+            }
+        }
+    }
+}
+
+/**
+ * 基数ごとに FFT_FN(mixed_radix_stage) を展開して呼ぶ（基数が定数になりループが展開される）
+ */
+static void FFT_FN(mixed_radix_dispatch)(int r, int m, int s,
+                                 const FFT_REAL *xr, const FFT_REAL *xi,
+                                 FFT_REAL *yr, FFT_REAL *yi,
+                                 const FFT_COMPLEX *tw) {
+    switch (r) {
+    case 2: FFT_FN(mixed_radix_stage)(2, m, s, xr, xi, yr, yi, tw); break;
+    case 3: FFT_FN(mixed_radix_stage)(3, m, s, xr, xi, yr, yi, tw); break;
+    case 4: FFT_FN(mixed_radix_stage)(4, m, s, xr, xi, yr, yi, tw); break;
+    case 5: FFT_FN(mixed_radix_stage)(5, m, s, xr, xi, yr, yi, tw); break;
+    case 7: FFT_FN(mixed_radix_stage)(7, m, s, xr, xi, yr, yi, tw); break;
+    }
+}
+
+/**
+ * 混合基数プランを生成（n は 2, 3, 5, 7 の積）
+ */
+static FFT_PLAN *FFT_FN(fft_plan_create_mixed)(int n) {
+    FFT_PLAN *p = (FFT_PLAN *)calloc(1, sizeof(FFT_PLAN));
+    if (!p) return NULL;
+    p->n = n;
+    atomic_flag_clear(&p->work_busy);
+
+    // 基数の並び: 4 をできるだけ使い、残りを 2, 3, 5, 7 で分解
+    int rest = n;
+    size_t tw_len = 0;
+    static const int radix_order[] = { 4, 2, 3, 5, 7 };
+    for (int i = 0; i < 5; i++) {
+        int r = radix_order[i];
+        while (rest % r == 0) {
+            p->radices[p->num_radices++] = r;
+            rest /= r;
+        }
+    }
+    int len = n;
+    for (int st = 0; st < p->num_radices; st++) {
+        tw_len += (size_t)(len / p->radices[st]) * (p->radices[st] - 1);
+        len /= p->radices[st];
+    }
+
+    p->mixed_tw = (FFT_COMPLEX *)malloc((tw_len > 0 ? tw_len : 1) * sizeof(FFT_COMPLEX));
+    if (!p->mixed_tw) {
+        FFT_FN(fft_plan_destroy)(p);
+        return NULL;
+    }
+    FFT_COMPLEX *tw = p->mixed_tw;
+    len = n;
+    for (int st = 0; st < p->num_radices; st++) {
+        int r = p->radices[st];
+        int m = len / r;
+        for (int q = 0; q < m; q++) {
+            for (int u = 1; u < r; u++) {
+                double ang = 2.0 * M_PI * (double)((long long)q * u) / len;
+                *tw++ = cos(ang) + I * sin(ang);
+            }
+        }
+        len = m;
+    }
+    return p;
+}
+
+/**
+ * 混合基数FFTを実行
+ */
+static void FFT_FN(fft_execute_mixed)(const FFT_PLAN *plan, FFT_COMPLEX *x,
+                              FFT_REAL sign, FFT_REAL scale) {
+    int n = plan->n;
+    int owned;
+    FFT_REAL *work = FFT_FN(fft_work_acquire)(plan, 4 * (size_t)n, &owned);
+    FFT_REAL *xr = work, *xi = work + n;
+    FFT_REAL *yr = work + 2 * (size_t)n, *yi = work + 3 * (size_t)n;
+
+    for (int i = 0; i < n; i++) {
+        xr[i] = FFT_CREAL(x[i]);
+        xi[i] = sign * FFT_CIMAG(x[i]);
+    }
+
+    const FFT_COMPLEX *tw = plan->mixed_tw;
+    int s = 1;
+    for (int st = 0; st < plan->num_radices; st++) {
+        int r = plan->radices[st];
+        int m = n / (s * r);
+        FFT_FN(mixed_radix_dispatch)(r, m, s, xr, xi, yr, yi, tw);
+        tw += (size_t)m * (r - 1);
+        FFT_REAL *t = xr; xr = yr; yr = t;
+        t = xi; xi = yi; yi = t;
+        s *= r;
+    }
+
+    for (int i = 0; i < n; i++) {
+        x[i] = scale * xr[i] + I * (sign * scale * xi[i]);
+    }
+    FFT_FN(fft_work_release)(plan, work, owned);
+}
+
+/**
+ * Bluestein 法のプランを生成（任意の長さ）
+ * X[k] = c[k] Σ x[j] c[j] FFT_CONJ(c[k-j]),  c[k] = exp(+jπk^2/n)
+ * の畳み込みを m >= 2n-1 点の2のべき乗FFTで計算する。
+ */
+static FFT_PLAN *FFT_FN(fft_plan_create_bluestein)(int n) {
+    FFT_PLAN *p = (FFT_PLAN *)calloc(1, sizeof(FFT_PLAN));
+    if (!p) return NULL;
+    p->n = n;
+    atomic_flag_clear(&p->work_busy);
+
+    int m = 1;
+    while (m < 2 * n - 1) m <<= 1;
+    p->conv = FFT_FN(fft_plan_create)(m);
+    p->chirp = (FFT_COMPLEX *)malloc(n * sizeof(FFT_COMPLEX));
+    p->chirp_fft = (FFT_COMPLEX *)calloc(m, sizeof(FFT_COMPLEX));
+    if (!p->conv || !p->chirp || !p->chirp_fft) {
+        FFT_FN(fft_plan_destroy)(p);
+        return NULL;
+    }
+
+    for (int k = 0; k < n; k++) {
+        // k^2 mod 2n で位相を求め、大きな k でも精度を落とさない
+        long long k2 = ((long long)k * k) % (2LL * n);
+        double ang = M_PI * (double)k2 / n;
+        p->chirp[k] = cos(ang) + I * sin(ang);
+    }
+    p->chirp_fft[0] = FFT_CONJ(p->chirp[0]);
+    for (int k = 1; k < n; k++) {
+        p->chirp_fft[k] = FFT_CONJ(p->chirp[k]);
+        p->chirp_fft[m - k] = FFT_CONJ(p->chirp[k]);
+    }
+    FFT_FN(fft_execute)(p->conv, p->chirp_fft, FFT_FORWARD);
+    return p;
+}
+
+/**
+ * Bluestein 法によるFFTを実行
+ */
+static void FFT_FN(fft_execute_bluestein)(const FFT_PLAN *plan, FFT_COMPLEX *x,
+                                  FFT_REAL sign, FFT_REAL scale) {
+    int n = plan->n;
+    int m = plan->conv->n;
+    int owned;
+    FFT_COMPLEX *a = (FFT_COMPLEX *)FFT_FN(fft_work_acquire)(plan, 2 * (size_t)m, &owned);
+
+    for (int k = 0; k < n; k++) {
+        FFT_COMPLEX v = FFT_CREAL(x[k]) + I * (sign * FFT_CIMAG(x[k]));
+        FFT_COMPLEX c = plan->chirp[k];
+        a[k] = (FFT_CREAL(v) * FFT_CREAL(c) - FFT_CIMAG(v) * FFT_CIMAG(c))
+             + I * (FFT_CREAL(v) * FFT_CIMAG(c) + FFT_CIMAG(v) * FFT_CREAL(c));
+    }
+    for (int k = n; k < m; k++) a[k] = 0.0;
+
+    FFT_FN(fft_execute)(plan->conv, a, FFT_FORWARD);
+    for (int k = 0; k < m; k++) {
+        FFT_COMPLEX b = plan->chirp_fft[k];
+        a[k] = (FFT_CREAL(a[k]) * FFT_CREAL(b) - FFT_CIMAG(a[k]) * FFT_CIMAG(b))
+             + I * (FFT_CREAL(a[k]) * FFT_CIMAG(b) + FFT_CIMAG(a[k]) * FFT_CREAL(b));
+    }
+    FFT_FN(fft_execute)(plan->conv, a, FFT_INVERSE);
+
+    for (int k = 0; k < n; k++) {
+        FFT_COMPLEX c = plan->chirp[k];
+        FFT_REAL vr = FFT_CREAL(a[k]) * FFT_CREAL(c) - FFT_CIMAG(a[k]) * FFT_CIMAG(c);
+        FFT_REAL vi = FFT_CREAL(a[k]) * FFT_CIMAG(c) + FFT_CIMAG(a[k]) * FFT_CREAL(c);
+        x[k] = scale * vr + I * (sign * scale * vi);
+    }
+    FFT_FN(fft_work_release)(plan, (FFT_REAL *)a, owned);
+}
+
+FFT_PLAN *FFT_FN(fft_plan_create)(int n) {
+    if (n < 1) return NULL;
+    if (!is_power_of_two(n)) {
+        return is_smooth(n) ? FFT_FN(fft_plan_create_mixed)(n) : FFT_FN(fft_plan_create_bluestein)(n);
+    }
+    if (n >= FFT_BLOCKED_MIN_N) return FFT_FN(fft_plan_create_blocked)(n);
+
+    FFT_PLAN *p = (FFT_PLAN *)calloc(1, sizeof(FFT_PLAN));
+    if (!p) return NULL;
+    p->n = n;
+    atomic_flag_clear(&p->work_busy);
+    p->bitrev = (int *)malloc(n * sizeof(int));
+    p->tw_re = (FFT_REAL *)malloc(n * sizeof(FFT_REAL));
+    p->tw_im = (FFT_REAL *)malloc(n * sizeof(FFT_REAL));
+    if (!p->bitrev || !p->tw_re || !p->tw_im) {
+        FFT_FN(fft_plan_destroy)(p);
+        return NULL;
+    }
+
+    // ビット反転表
+    p->bitrev[0] = 0;
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        p->bitrev[i] = j;
+    }
+
+    // 最終段（len = n）の回転因子を直接計算し、それより前の段は間引いて得る。
+    // 漸化式 w *= wlen を使わないため、長い変換でも位相誤差が蓄積しない。
+    p->tw_re[0] = 1.0;
+    p->tw_im[0] = 0.0;
+    for (int j = 0; j < n / 2; j++) {
+        double ang = 2.0 * M_PI * j / n;
+        p->tw_re[n / 2 + j] = cos(ang);
+        p->tw_im[n / 2 + j] = sin(ang);
+    }
+    for (int len = n / 2; len >= 2; len >>= 1) {
+        int stride = n / len;
+        for (int j = 0; j < len / 2; j++) {
+            p->tw_re[len / 2 + j] = p->tw_re[n / 2 + j * stride];
+            p->tw_im[len / 2 + j] = p->tw_im[n / 2 + j * stride];
+        }
+    }
+
+    p->radix4_stage = FFT_FN(radix4_stage_scalar);
+#ifdef FFT_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        p->radix4_stage = FFT_FN(radix4_stage_avx2);
+    }
+#endif
+
+    return p;
+}
+
+FFT_PLAN *FFT_FN(fft_plan_create_real)(int n) {
+    if (n < 2 || n % 2 != 0) return NULL;
+
+    FFT_PLAN *p = (FFT_PLAN *)calloc(1, sizeof(FFT_PLAN));
+    if (!p) return NULL;
+    p->n = n;
+    atomic_flag_clear(&p->work_busy);
+    p->half = FFT_FN(fft_plan_create)(n / 2);
+    p->real_twiddle = (FFT_COMPLEX *)malloc((n / 4 + 1) * sizeof(FFT_COMPLEX));
+    if (!p->half || !p->real_twiddle) {
+        FFT_FN(fft_plan_destroy)(p);
+        return NULL;
+    }
+    for (int k = 0; k <= n / 4; k++) {
+        double ang = 2.0 * M_PI * k / n;
+        p->real_twiddle[k] = cos(ang) + I * sin(ang);
+    }
+    return p;
+}
+
+void FFT_FN(fft_execute)(const FFT_PLAN *plan, FFT_COMPLEX *x, int direction) {
+    int n = plan->n;
+    FFT_REAL sign = (direction == FFT_FORWARD) ? 1.0 : -1.0;
+    FFT_REAL scale = (direction == FFT_FORWARD) ? 1.0 : 1.0 / n;
+
+    if (plan->row1) {
+        FFT_FN(fft_execute_blocked)(plan, x, sign, scale);
+        return;
+    }
+    if (plan->num_radices > 0) {
+        FFT_FN(fft_execute_mixed)(plan, x, sign, scale);
+        return;
+    }
+    if (plan->conv) {
+        FFT_FN(fft_execute_bluestein)(plan, x, sign, scale);
+        return;
+    }
+
+    int owned;
+    FFT_REAL *re = FFT_FN(fft_work_acquire)(plan, 2 * (size_t)n, &owned);
+    FFT_REAL *im = re + n;
+
+    // ビット反転順に並べ替えながら SoA へ展開（逆変換は共役を取る）
+    for (int i = 0; i < n; i++) {
+        FFT_COMPLEX v = x[plan->bitrev[i]];
+        re[i] = FFT_CREAL(v);
+        im[i] = sign * FFT_CIMAG(v);
+    }
+
+    FFT_FN(fft_stages)(plan, re, im);
+
+    // インターリーブ形式へ戻す（逆変換は共役と 1/N 正規化）
+    for (int i = 0; i < n; i++) {
+        x[i] = scale * re[i] + I * (sign * scale * im[i]);
+    }
+
+    FFT_FN(fft_work_release)(plan, re, owned);
+}
+
+void FFT_FN(fft_execute_r2c)(const FFT_PLAN *plan, FFT_COMPLEX *X) {
+    int n = plan->n;
+    int h = n / 2;
+    FFT_FN(fft_execute)(plan->half, X, FFT_FORWARD);
+
+    // Z = E + jO から E(偶数列のDFT), O(奇数列のDFT) を分離して合成
+    FFT_REAL z0r = FFT_CREAL(X[0]), z0i = FFT_CIMAG(X[0]);
+    X[0] = z0r + z0i;
+    X[h] = z0r - z0i;
+    for (int k = 1; k <= h / 2; k++) {
+        FFT_COMPLEX a = X[k];
+        FFT_COMPLEX b = FFT_CONJ(X[h - k]);
+        FFT_COMPLEX e = 0.5 * (a + b);
+        FFT_COMPLEX o = -0.5 * I * (a - b);
+        FFT_COMPLEX w = plan->real_twiddle[k];
+        X[k] = e + w * o;
+        X[h - k] = FFT_CONJ(e - w * o);
+    }
+}
+
+void FFT_FN(fft_execute_c2r)(const FFT_PLAN *plan, FFT_COMPLEX *X) {
+    int n = plan->n;
+    int h = n / 2;
+
+    // 前処理: X から Z = E + jO を組み立てる
+    FFT_REAL x0 = FFT_CREAL(X[0]), xh = FFT_CREAL(X[h]);
+    X[0] = 0.5 * (x0 + xh) + 0.5 * I * (x0 - xh);
+    for (int k = 1; k <= h / 2; k++) {
+        FFT_COMPLEX a = X[k];
+        FFT_COMPLEX b = FFT_CONJ(X[h - k]);
+        FFT_COMPLEX w = plan->real_twiddle[k];
+        FFT_COMPLEX e = 0.5 * (a + b);
+        FFT_COMPLEX o = 0.5 * (a - b) * FFT_CONJ(w);
+        X[k] = e + I * o;
+        X[h - k] = FFT_CONJ(e) + I * FFT_CONJ(o);
+    }
+
+    FFT_FN(fft_execute)(plan->half, X, FFT_INVERSE);
+}
+
+void FFT_FN(fft_plan_destroy)(FFT_PLAN *plan) {
+    if (!plan) return;
+    free(plan->bitrev);
+    free(plan->tw_re);
+    free(plan->tw_im);
+    FFT_FN(fft_plan_destroy)(plan->row1);
+    FFT_FN(fft_plan_destroy)(plan->row2);
+    free(plan->tw_lo);
+    free(plan->tw_hi);
+    free(plan->work);
+    free(plan->mixed_tw);
+    FFT_FN(fft_plan_destroy)(plan->conv);
+    free(plan->chirp);
+    free(plan->chirp_fft);
+    FFT_FN(fft_plan_destroy)(plan->half);
+    free(plan->real_twiddle);
+    free(plan);
+}
+
+#undef FFT_REAL
+#undef FFT_COMPLEX
+#undef FFT_PLAN
+#undef FFT_FN
+#undef FFT_CREAL
+#undef FFT_CIMAG
+#undef FFT_CONJ
+#undef FFT_VEC
+#undef FFT_VLEN
+#undef FFT_VLOAD
+#undef FFT_VSTORE
+#undef FFT_VADD
+#undef FFT_VSUB
+#undef FFT_VMUL
+#undef FFT_VFMADD
+#undef FFT_VFMSUB
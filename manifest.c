@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "manifest.h"
+
+/*
+ * 可変長のジョブ一覧・文字列一覧
+ */
+static int push_job(ManifestJob **jobs, int *num_jobs, int *capacity, ManifestJob job) {
+    if (*num_jobs == *capacity) {
+        int cap = *capacity ? *capacity * 2 : 16;
+        ManifestJob *p = (ManifestJob *)realloc(*jobs, cap * sizeof(ManifestJob));
+        if (!p) return -1;
+        *jobs = p;
+        *capacity = cap;
+    }
+    (*jobs)[(*num_jobs)++] = job;
+    return 0;
+}
+
+static int push_take(ManifestJob *job, int *capacity, char *take) {
+    if (job->num_takes == *capacity) {
+        int cap = *capacity ? *capacity * 2 : 4;
+        char **p = (char **)realloc(job->takes, cap * sizeof(char *));
+        if (!p) return -1;
+        job->takes = p;
+        *capacity = cap;
+    }
+    job->takes[job->num_takes++] = take;
+    return 0;
+}
+
+static void free_job(ManifestJob *job) {
+    free(job->output);
+    for (int i = 0; i < job->num_takes; i++) free(job->takes[i]);
+    free(job->takes);
+}
+
+static char *copy_range(const char *begin, const char *end) {
+    size_t len = (size_t)(end - begin);
+    char *s = (char *)malloc(len + 1);
+    if (!s) return NULL;
+    memcpy(s, begin, len);
+    s[len] = '\0';
+    return s;
+}
+
+/**
+ * CSV 形式のジョブ一覧を解析
+ */
+static int parse_csv(const char *filename, char *text, ManifestJob **jobs, int *num_jobs) {
+    int capacity = 0;
+    int line_no = 0;
+    for (char *line = text; line && *line; ) {
+        char *next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        line_no++;
+
+        // 前後の空白（改行コードの \r を含む）を除く
+        char *end = line + strlen(line);
+        while (end > line && isspace((unsigned char)end[-1])) end--;
+        *end = '\0';
+        while (isspace((unsigned char)*line)) line++;
+        if (*line == '\0' || *line == '#') {
+            line = next;
+            continue;
+        }
+
+        ManifestJob job = { NULL, NULL, 0 };
+        int take_capacity = 0;
+        int field = 0;
+        for (char *p = line; ; field++) {
+            char *comma = strchr(p, ',');
+            char *stop = comma ? comma : p + strlen(p);
+            char *b = p, *e = stop;
+            while (b < e && isspace((unsigned char)*b)) b++;
+            while (e > b && isspace((unsigned char)e[-1])) e--;
+            if (b == e) {
+                fprintf(stderr, "エラー: %s:%d 列 %d が空です\n", filename, line_no, field + 1);
+                free_job(&job);
+                return -1;
+            }
+            char *value = copy_range(b, e);
+            int ok = (value != NULL);
+            if (ok && field == 0) {
+                job.output = value;
+            } else if (ok) {
+                ok = (push_take(&job, &take_capacity, value) == 0);
+            }
+            if (!ok) {
+                fprintf(stderr, "エラー: メモリ確保に失敗\n");
+                free(value);
+                free_job(&job);
+                return -1;
+            }
+            if (!comma) break;
+            p = comma + 1;
+        }
+        if (job.num_takes < 1) {
+            fprintf(stderr, "エラー: %s:%d に応答ファイルがありません（出力,テイク1,テイク2,... の形式）\n", filename, line_no);
+            free_job(&job);
+            return -1;
+        }
+        if (push_job(jobs, num_jobs, &capacity, job) < 0) {
+            fprintf(stderr, "エラー: メモリ確保に失敗\n");
+            free_job(&job);
+            return -1;
+        }
+        line = next;
+    }
+    return 0;
+}
+
+/*
+ * JSON の解析（ジョブ一覧に必要な範囲のみ）
+ */
+typedef struct {
+    const char *p;
+    const char *begin;
+    const char *filename;
+} JsonParser;
+
+static void json_error(const JsonParser *js, const char *what) {
+    fprintf(stderr, "エラー: %s の %ld バイト目: %s\n", js->filename, (long)(js->p - js->begin), what);
+}
+
+static void json_skip_ws(JsonParser *js) {
+    while (isspace((unsigned char)*js->p)) js->p++;
+}
+
+static int json_expect(JsonParser *js, char c) {
+    json_skip_ws(js);
+    if (*js->p != c) {
+        char msg[32];
+        snprintf(msg, sizeof(msg), "'%c' がありません", c);
+        json_error(js, msg);
+        return -1;
+    }
+    js->p++;
+    return 0;
+}
+
+/**
+ * 文字列を読み込む（\uXXXX は ASCII の範囲のみ対応）
+ * 戻り値: 確保した文字列、エラー時は NULL
+ */
+static char *json_string(JsonParser *js) {
+    if (json_expect(js, '"') < 0) return NULL;
+    size_t cap = 64, len = 0;
+    char *s = (char *)malloc(cap);
+    while (s) {
+        char c = *js->p++;
+        if (c == '\0') {
+            js->p--;
+            json_error(js, "文字列が閉じていません");
+            free(s);
+            return NULL;
+        }
+        if (c == '"') break;
+        if (c == '\\') {
+            if (*js->p == '\0') {
+                json_error(js, "文字列が閉じていません");
+                free(s);
+                return NULL;
+            }
+            char e = *js->p++;
+            switch (e) {
+            case '"': case '\\': case '/': c = e; break;
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'u': {
+                unsigned v = 0;
+                for (int i = 0; i < 4; i++) {
+                    if (*js->p == '\0') {
+                        json_error(js, "文字列が閉じていません");
+                        free(s);
+                        return NULL;
+                    }
+                    char h = *js->p++;
+                    v <<= 4;
+                    if (h >= '0' && h <= '9') v |= h - '0';
+                    else if (h >= 'a' && h <= 'f') v |= h - 'a' + 10;
+                    else if (h >= 'A' && h <= 'F') v |= h - 'A' + 10;
+                    else v = 0x100;
+                }
+                if (v == 0 || v > 0x7f) {
+                    json_error(js, "\\u は ASCII の範囲のみ対応しています");
+                    free(s);
+                    return NULL;
+                }
+                c = (char)v;
+                break;
+            }
+            default:
+                json_error(js, "不正なエスケープです");
+                free(s);
+                return NULL;
+            }
+        }
+        if (len + 1 >= cap) {
+            char *p = (char *)realloc(s, cap * 2);
+            if (!p) {
+                free(s);
+                s = NULL;
+                break;
+            }
+            s = p;
+            cap *= 2;
+        }
+        s[len++] = c;
+    }
+    if (!s) {
+        fprintf(stderr, "エラー: メモリ確保に失敗\n");
+        return NULL;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+/**
+ * 値を1つ読み飛ばす（使わないキーの値）
+ */
+static int json_skip_value(JsonParser *js) {
+    json_skip_ws(js);
+    char c = *js->p;
+    if (c == '"') {
+        char *s = json_string(js);
+        free(s);
+        return s ? 0 : -1;
+    }
+    if (c == '[' || c == '{') {
+        char close = (c == '[') ? ']' : '}';
+        js->p++;
+        json_skip_ws(js);
+        if (*js->p == close) {
+            js->p++;
+            return 0;
+        }
+        for (;;) {
+            if (c == '{') {
+                char *key = json_string(js);
+                if (!key) return -1;
+                free(key);
+                if (json_expect(js, ':') < 0) return -1;
+            }
+            if (json_skip_value(js) < 0) return -1;
+            json_skip_ws(js);
+            if (*js->p == ',') {
+                js->p++;
+                continue;
+            }
+            return json_expect(js, close);
+        }
+    }
+    // 数値・true・false・null
+    const char *start = js->p;
+    while (*js->p && (isalnum((unsigned char)*js->p) || strchr("+-.", *js->p))) js->p++;
+    if (js->p == start) {
+        json_error(js, "値がありません");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 1ジョブ分のオブジェクトを読み込む
+ */
+static int json_job(JsonParser *js, ManifestJob *job) {
+    int take_capacity = 0;
+    if (json_expect(js, '{') < 0) return -1;
+    json_skip_ws(js);
+    if (*js->p != '}') {
+        for (;;) {
+            char *key = json_string(js);
+            if (!key) return -1;
+            if (json_expect(js, ':') < 0) {
+                free(key);
+                return -1;
+            }
+            int status = 0;
+            if (strcmp(key, "output") == 0) {
+                free(job->output);
+                job->output = json_string(js);
+                if (!job->output) status = -1;
+            } else if (strcmp(key, "takes") == 0) {
+                status = json_expect(js, '[');
+                json_skip_ws(js);
+                if (status == 0 && *js->p == ']') {
+                    js->p++;
+                } else {
+                    while (status == 0) {
+                        char *take = json_string(js);
+                        if (!take || push_take(job, &take_capacity, take) < 0) {
+                            free(take);
+                            status = -1;
+                            break;
+                        }
+                        json_skip_ws(js);
+                        if (*js->p == ',') {
+                            js->p++;
+                            continue;
+                        }
+                        status = json_expect(js, ']');
+                        break;
+                    }
+                }
+            } else {
+                status = json_skip_value(js);
+            }
+            free(key);
+            if (status < 0) return -1;
+            json_skip_ws(js);
+            if (*js->p == ',') {
+                js->p++;
+                continue;
+            }
+            break;
+        }
+    }
+    if (json_expect(js, '}') < 0) return -1;
+    if (!job->output || job->num_takes < 1) {
+        json_error(js, "ジョブには \"output\" と1つ以上の \"takes\" が必要です");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * JSON 形式のジョブ一覧を解析
+ */
+static int parse_json(const char *filename, const char *text, ManifestJob **jobs, int *num_jobs) {
+    JsonParser js = { text, text, filename };
+    int capacity = 0;
+    if (json_expect(&js, '[') < 0) return -1;
+    json_skip_ws(&js);
+    if (*js.p == ']') {
+        js.p++;
+    } else {
+        for (;;) {
+            ManifestJob job = { NULL, NULL, 0 };
+            if (json_job(&js, &job) < 0 || push_job(jobs, num_jobs, &capacity, job) < 0) {
+                free_job(&job);
+                return -1;
+            }
+            json_skip_ws(&js);
+            if (*js.p == ',') {
+                js.p++;
+                continue;
+            }
+            if (json_expect(&js, ']') < 0) return -1;
+            break;
+        }
+    }
+    json_skip_ws(&js);
+    if (*js.p != '\0') {
+        json_error(&js, "配列の後に余分な内容があります");
+        return -1;
+    }
+    return 0;
+}
+
+int manifest_load(const char *filename, ManifestJob **jobs, int *num_jobs) {
+    *jobs = NULL;
+    *num_jobs = 0;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "エラー: %s を開けません\n", filename);
+        return -1;
+    }
+    size_t cap = 4096, len = 0;
+    char *text = (char *)malloc(cap);
+    size_t n;
+    while (text && (n = fread(text + len, 1, cap - len - 1, fp)) > 0) {
+        len += n;
+        if (len + 1 == cap) {
+            char *p = (char *)realloc(text, cap * 2);
+            if (!p) {
+                free(text);
+                text = NULL;
+                break;
+            }
+            text = p;
+            cap *= 2;
+        }
+    }
+    fclose(fp);
+    if (!text) {
+        fprintf(stderr, "エラー: メモリ確保に失敗\n");
+        return -1;
+    }
+    text[len] = '\0';
+
+    const char *first = text;
+    while (isspace((unsigned char)*first)) first++;
+    int status = (*first == '[') ? parse_json(filename, text, jobs, num_jobs)
+                                 : parse_csv(filename, text, jobs, num_jobs);
+    free(text);
+    if (status == 0 && *num_jobs == 0) {
+        fprintf(stderr, "エラー: %s にジョブがありません\n", filename);
+        status = -1;
+    }
+    if (status < 0) {
+        manifest_free(*jobs, *num_jobs);
+        *jobs = NULL;
+        *num_jobs = 0;
+    }
+    return status;
+}
+
+void manifest_free(ManifestJob *jobs, int num_jobs) {
+    if (!jobs) return;
+    for (int i = 0; i < num_jobs; i++) free_job(&jobs[i]);
+    free(jobs);
+}
@@ -0,0 +1,30 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+/*
+ * 一括処理のジョブ一覧（tsp_to_ir --batch）
+ * 1ジョブは出力ファイル1つと、平均する応答ファイル（テイク）1つ以上からなる。
+ *
+ * CSV: 1行1ジョブで「出力,テイク1,テイク2,...」。空行と # で始まる行は無視し、
+ *      各欄の前後の空白は取り除く（引用符には対応しない）。
+ * JSON: [{"output": "ir.wav", "takes": ["rec1.wav", "rec2.wav"]}, ...]
+ *       ファイルの先頭（空白を除く）が [ のときに JSON とみなす。他のキーは無視する。
+ */
+typedef struct {
+    char *output;       // 出力ファイル
+    char **takes;       // 応答ファイル
+    int num_takes;
+} ManifestJob;
+
+/**
+ * ジョブ一覧を読み込む
+ * 戻り値: 0、エラー時は-1（エラー内容は標準エラーに表示）
+ */
+int manifest_load(const char *filename, ManifestJob **jobs, int *num_jobs);
+
+/**
+ * manifest_load で読み込んだジョブ一覧を解放
+ */
+void manifest_free(ManifestJob *jobs, int num_jobs);
+
+#endif
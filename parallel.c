@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+typedef struct {
+    parallel_func fn;
+    void *ctx;
+    int begin;
+    int end;
+} parallel_task;
+
+static void *parallel_entry(void *arg) {
+    parallel_task *task = (parallel_task *)arg;
+    task->fn(task->ctx, task->begin, task->end);
+    return NULL;
+}
+
+void parallel_for(int count, int num_threads, parallel_func fn, void *ctx) {
+    if (count <= 0) return;
+    if (num_threads > count) num_threads = count;
+    if (num_threads <= 1) {
+        fn(ctx, 0, count);
+        return;
+    }
+
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    parallel_task *tasks = (parallel_task *)malloc(num_threads * sizeof(parallel_task));
+    int *started = (int *)calloc(num_threads, sizeof(int));
+    if (!threads || !tasks || !started) {
+        free(threads);
+        free(tasks);
+        free(started);
+        fn(ctx, 0, count);
+        return;
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        tasks[t].fn = fn;
+        tasks[t].ctx = ctx;
+        tasks[t].begin = (int)((long long)count * t / num_threads);
+        tasks[t].end = (int)((long long)count * (t + 1) / num_threads);
+    }
+    // 先頭の区間は呼び出し元で処理し、スレッドを起動できなかった区間も同様に処理する
+    for (int t = 1; t < num_threads; t++) {
+        started[t] = (pthread_create(&threads[t], NULL, parallel_entry, &tasks[t]) == 0);
+    }
+    parallel_entry(&tasks[0]);
+    for (int t = 1; t < num_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            parallel_entry(&tasks[t]);
+        }
+    }
+
+    free(threads);
+    free(tasks);
+    free(started);
+}
+
+int parallel_num_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
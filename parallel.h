@@ -0,0 +1,19 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+ * 簡易並列ループ（pthreads）
+ * [0, count) を num_threads 個の連続区間に分け、各区間で fn(ctx, begin, end) を呼ぶ。
+ * 区間の分け方はスレッド数だけで決まるため、同じスレッド数なら結果は再現する。
+ * 呼び出し元のスレッドも1区間を担当し、全区間の終了を待ってから戻る。
+ */
+typedef void (*parallel_func)(void *ctx, int begin, int end);
+
+void parallel_for(int count, int num_threads, parallel_func fn, void *ctx);
+
+/**
+ * 利用可能なCPUコア数（取得できなければ1）
+ */
+int parallel_num_cpus(void);
+
+#endif
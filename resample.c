@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#include "resample.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RESAMPLE_HAVE_AVX2 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Kaiser窓のβ（阻止域減衰 約80dB）
+#define RESAMPLE_KAISER_BETA 8.0
+
+// タップ数の上限
+#define RESAMPLE_MAX_TAPS 256
+
+struct resampler {
+    int taps;
+    int phases;
+    float *table;   // (phases+1) × taps の係数。行 p は小数位置 p/phases に対応
+};
+
+/**
+ * 第1種変形ベッセル関数 I0（級数展開）
+ */
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-17) break;
+    }
+    return sum;
+}
+
+resampler *resampler_create(int taps, int phases) {
+    if (taps < 8 || taps > RESAMPLE_MAX_TAPS || taps % 8 != 0 || phases < 1) return NULL;
+    resampler *rs = (resampler *)malloc(sizeof(resampler));
+    if (!rs) return NULL;
+    rs->taps = taps;
+    rs->phases = phases;
+    rs->table = (float *)malloc((size_t)(phases + 1) * taps * sizeof(float));
+    if (!rs->table) {
+        free(rs);
+        return NULL;
+    }
+
+    // タップ t は入力 floor(pos) - taps/2 + 1 + t に掛かり、位置の差は t - taps/2 + 1 - frac
+    double half = taps / 2;
+    double norm = bessel_i0(RESAMPLE_KAISER_BETA);
+    for (int p = 0; p <= phases; p++) {
+        double frac = (double)p / phases;
+        double h[RESAMPLE_MAX_TAPS];
+        double sum = 0;
+        for (int t = 0; t < taps; t++) {
+            double x = t - half + 1 - frac;
+            double u = x / half;
+            double win = (fabs(u) < 1) ? bessel_i0(RESAMPLE_KAISER_BETA * sqrt(1 - u * u)) / norm : 0;
+            double sinc = (x == 0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            h[t] = sinc * win;
+            sum += h[t];
+        }
+        // 直流の利得を1にそろえる
+        for (int t = 0; t < taps; t++) {
+            rs->table[(size_t)p * taps + t] = (float)(h[t] / sum);
+        }
+    }
+    return rs;
+}
+
+int resampler_taps(const resampler *rs) {
+    return rs->taps;
+}
+
+/**
+ * 1サンプル分の積和（スカラー版）
+ * AVX2 版と同じく8レーンに分けて足し、同じ順序でまとめるため結果は一致する。
+ */
+static float resample_dot_scalar(const float *x, const float *r0, const float *r1, float w, int taps) {
+    float lane[8] = { 0 };
+    for (int t = 0; t < taps; t += 8) {
+        for (int j = 0; j < 8; j++) {
+            float coef = r0[t + j] + w * (r1[t + j] - r0[t + j]);
+            lane[j] += coef * x[t + j];
+        }
+    }
+    float a0 = lane[0] + lane[4], a1 = lane[1] + lane[5];
+    float a2 = lane[2] + lane[6], a3 = lane[3] + lane[7];
+    return (a0 + a2) + (a1 + a3);
+}
+
+#ifdef RESAMPLE_HAVE_AVX2
+/**
+ * 1サンプル分の積和（AVX2版）
+ */
+__attribute__((target("avx2")))
+static float resample_dot_avx2(const float *x, const float *r0, const float *r1, float w, int taps) {
+    __m256 vw = _mm256_set1_ps(w);
+    __m256 acc = _mm256_setzero_ps();
+    for (int t = 0; t < taps; t += 8) {
+        __m256 c0 = _mm256_loadu_ps(r0 + t);
+        __m256 c1 = _mm256_loadu_ps(r1 + t);
+        __m256 coef = _mm256_add_ps(c0, _mm256_mul_ps(vw, _mm256_sub_ps(c1, c0)));
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(coef, _mm256_loadu_ps(x + t)));
+    }
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+#endif
+
+void resampler_process(const resampler *rs, const float *src, int64_t src_len,
+                       double start, double step, float *dst, int count) {
+    float (*dot)(const float *, const float *, const float *, float, int) = resample_dot_scalar;
+#ifdef RESAMPLE_HAVE_AVX2
+    // 複数のスレッドから呼ばれるため、判定結果は原子的に読み書きする
+    static atomic_int use_avx2 = -1;
+    int avx2 = atomic_load(&use_avx2);
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        atomic_store(&use_avx2, avx2);
+    }
+    if (avx2) dot = resample_dot_avx2;
+#endif
+
+    int taps = rs->taps;
+    float edge[RESAMPLE_MAX_TAPS]; // 範囲外を0で埋めた入力（端の付近のみ使う）
+    for (int i = 0; i < count; i++) {
+        // 位置は毎回計算し直し、刻みの誤差を溜めない
+        double pos = start + i * step;
+        double base = floor(pos);
+        double phase = (pos - base) * rs->phases;
+        int p = (int)phase;
+        if (p >= rs->phases) p = rs->phases - 1;
+        float w = (float)(phase - p);
+        const float *r0 = rs->table + (size_t)p * taps;
+        const float *r1 = r0 + taps;
+
+        int64_t first = (int64_t)base - taps / 2 + 1;
+        const float *x;
+        if (first >= 0 && first + taps <= src_len) {
+            x = src + first;
+        } else {
+            for (int t = 0; t < taps; t++) {
+                int64_t k = first + t;
+                edge[t] = (k >= 0 && k < src_len) ? src[k] : 0.0f;
+            }
+            x = edge;
+        }
+        dst[i] = dot(x, r0, r1, w, taps);
+    }
+}
+
+void resampler_destroy(resampler *rs) {
+    if (!rs) return;
+    free(rs->table);
+    free(rs);
+}
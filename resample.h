@@ -0,0 +1,39 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <stdint.h>
+
+/*
+ * 窓付きsincによる任意位置の補間（ポリフェーズ）
+ * 小数位置の係数を phases 個に分けて前計算し、隣り合う2つの位相の出力を
+ * 線形補間する。積和は AVX2 が使えれば8サンプルずつ計算する。
+ * 時計のずれ（数十ppm）の補正のように、ほぼ等倍の再標本化を想定している。
+ */
+typedef struct resampler resampler;
+
+/**
+ * 補間器を作成
+ * taps: フィルタのタップ数（8の倍数で256以下、例: 32）
+ * phases: 小数位置の分割数（例: 512）
+ * 戻り値: 補間器、エラー時は NULL
+ */
+resampler *resampler_create(int taps, int phases);
+
+/**
+ * 出力1サンプルの計算に使う入力の範囲（位置の前後 taps/2 サンプル）
+ */
+int resampler_taps(const resampler *rs);
+
+/**
+ * dst[i] = src の位置 start + i * step の補間値（i = 0〜count-1）
+ * src の範囲 [0, src_len) の外は 0 として扱う。
+ */
+void resampler_process(const resampler *rs, const float *src, int64_t src_len,
+                       double start, double step, float *dst, int count);
+
+/**
+ * 補間器を破棄
+ */
+void resampler_destroy(resampler *rs);
+
+#endif
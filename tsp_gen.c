@@ -1,75 +1,152 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <complex.h>
 #include <string.h>
 
+#include "fft.h"
+#include "tsp_inverse.h"
+#include "wav_io.h"
+
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-// WAVヘッダ構造体（44バイト）
-#pragma pack(push, 1)
-typedef struct {
-    char riff[4];           // "RIFF"
-    int chunk_size;         // ファイルサイズ - 8
-    char wave[4];           // "WAVE"
-    char fmt[4];            // "fmt "
-    int fmt_size;           // 16 (PCM)
-    short audio_format;     // 1 (PCM)
-    short num_channels;     // 1 (Mono)
-    int sample_rate;        // 48000
-    int byte_rate;          // sample_rate * channels * bits/8
-    short block_align;      // channels * bits/8
-    short bits_per_sample;  // 16
-    char data[4];           // "data"
-    int data_size;          // 波形データサイズ (N * 2 bytes)
-} WavHeader;
-#pragma pack(pop)
+static void usage(const char *prog) {
+    fprintf(stderr, "使用方法: %s [オプション] [出力ファイル]\n", prog);
+    fprintf(stderr, "  --length N   信号長（1周期、偶数、既定 262144）\n");
+    fprintf(stderr, "  --j J        実行長（1〜N/2、既定 N/2）\n");
+    fprintf(stderr, "  --fs FS      サンプリング周波数（既定 48000）\n");
+    fprintf(stderr, "  --shift N0   巡回シフト量（0〜N-1、既定 N/4）\n");
+    fprintf(stderr, "  --periods K  連続して書き出す周期数（既定 1）\n");
+    fprintf(stderr, "  --format     出力WAVの形式（pcm16 または float、既定 pcm16）\n");
+    fprintf(stderr, "  --threads N  IFFTに使うスレッド数（0で全コア、既定1）\n");
+    fprintf(stderr, "  --no-inverse 逆フィルタのサイドカー（<出力ファイル>.inv）を書き出さない\n");
+    fprintf(stderr, "出力ファイルの既定は tsp_signal.wav\n");
+}
 
 /**
- * 簡易IFFT (Radix-2)
- * 外部ライブラリ無しで動作させるための実装
+ * 逆フィルタのサイドカーを書き出す（tsp_to_ir が読み込んで TSP の FFT を省く）
+ * 書き出した1周期分（pcm または samples）をFFTし、スペクトルが十分小さいビンを
+ * マスクで除外する。tsp_to_ir がファイルから計算する場合と同じ結果になるよう、
+ * 量子化後のデータを使う。
+ * 戻り値: 0、エラー時は-1
  */
-void simple_ifft(double complex *x, int n) {
-    // ビット反転並べ替え
-    for (int i = 1, j = 0; i < n; i++) {
-        int bit = n >> 1;
-        for (; j & bit; bit >>= 1) j ^= bit;
-        j ^= bit;
-        if (i < j) {
-            double complex t = x[i]; x[i] = x[j]; x[j] = t;
-        }
+static int write_inverse_sidecar(const char *filename, const int16_t *pcm, const float *samples,
+                                 int N, int J, int n0) {
+    fft_plan *plan = fft_plan_create_real(N);
+    int num_bins = N / 2 + 1;
+    double complex *TSP = (double complex *)calloc(num_bins, sizeof(double complex));
+    double complex *inverse = (double complex *)malloc(num_bins * sizeof(double complex));
+    unsigned char *mask = (unsigned char *)malloc(num_bins);
+    if (!plan || !TSP || !inverse || !mask) {
+        fprintf(stderr, "Memory error\n");
+        if (plan) fft_plan_destroy(plan);
+        free(TSP); free(inverse); free(mask);
+        return -1;
     }
-    // クーリー・テューキー
-    for (int len = 2; len <= n; len <<= 1) {
-        double ang = -2.0 * M_PI / len; // 逆変換なのでマイナス
-        double complex wlen = cos(ang) + I * sin(ang);
-        for (int i = 0; i < n; i += len) {
-            double complex w = 1.0;
-            for (int j = 0; j < len / 2; j++) {
-                double complex u = x[i + j];
-                double complex v = x[i + j + len / 2] * w;
-                x[i + j] = u + v;
-                x[i + j + len / 2] = u - v;
-                w *= wlen;
-            }
-        }
+
+    // WAVから読み込んだときと同じ -1.0〜1.0 の値にしてFFT
+    double *tsp_time = (double *)TSP;
+    for (int i = 0; i < N; i++) {
+        tsp_time[i] = pcm ? (float)pcm[i] * (1.0f / 32768.0f) : samples[i];
     }
-    // 正規化
-    for (int i = 0; i < n; i++) x[i] /= n;
+    fft_execute_r2c(plan, TSP);
+    fft_plan_destroy(plan);
+
+    tsp_inverse_compute(inverse, N, J);
+    for (int k = 0; k < num_bins; k++) {
+        mask[k] = cabs(TSP[k]) > 1e-10;
+        if (!mask[k]) inverse[k] = 0.0;
+    }
+    free(TSP);
+
+    uint64_t hash = pcm ? tsp_hash(pcm, (size_t)N * sizeof(int16_t))
+                        : tsp_hash(samples, (size_t)N * sizeof(float));
+    char path[4096];
+    int status = tsp_inverse_path(path, sizeof(path), filename, ".inv");
+    if (status == 0) status = tsp_inverse_write(path, N, J, n0, hash, 0, inverse, mask);
+    if (status == 0) printf("逆フィルタ: %s を保存しました。\n", path);
+    free(inverse);
+    free(mask);
+    return status;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     // --- パラメータ ---
     int N = 262144;           // 信号長 (2^18)
-    int J = N / 2;            // 実行長 (信号長の半分)
+    int J = 0;                // 実行長 (既定は信号長の半分)
     int fs = 48000;           // サンプリング周波数
-    int n0 = N / 4;           // シフト量 (中央に寄せるためのオフセット)
+    int n0 = 0;               // シフト量 (既定は中央に寄せるための N/4)
+    int periods = 1;          // 周期数（同期加算用に同じ周期を繰り返す）
+    int out_format = WAV_FORMAT_PCM16;
+    int write_inverse = 1;    // 逆フィルタのサイドカーを書き出すか
     const char *filename = "tsp_signal.wav";
 
+    // --- オプション ---
+    int have_j = 0, have_shift = 0, have_filename = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            fft_set_threads(atoi(argv[++i])); // IFFTに使うスレッド数（0で全コア）
+        } else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+            N = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--j") == 0 && i + 1 < argc) {
+            J = atoi(argv[++i]);
+            have_j = 1;
+        } else if (strcmp(argv[i], "--fs") == 0 && i + 1 < argc) {
+            fs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shift") == 0 && i + 1 < argc) {
+            n0 = atoi(argv[++i]);
+            have_shift = 1;
+        } else if (strcmp(argv[i], "--periods") == 0 && i + 1 < argc) {
+            periods = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-inverse") == 0) {
+            write_inverse = 0;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char *fmt = argv[++i];
+            if (strcmp(fmt, "pcm16") == 0) {
+                out_format = WAV_FORMAT_PCM16;
+            } else if (strcmp(fmt, "float") == 0) {
+                out_format = WAV_FORMAT_FLOAT32;
+            } else {
+                fprintf(stderr, "エラー: --format は pcm16 または float を指定してください: %s\n", fmt);
+                return 1;
+            }
+        } else if (argv[i][0] != '-' && !have_filename) {
+            filename = argv[i];
+            have_filename = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!have_j) J = N / 2;
+    if (!have_shift) n0 = N / 4;
+
+    if (N < 4 || N % 2 != 0) {
+        fprintf(stderr, "エラー: 信号長は4以上の偶数を指定してください: %d\n", N);
+        return 1;
+    }
+    if (J < 1 || J > N / 2) {
+        fprintf(stderr, "エラー: 実行長は 1〜%d の範囲で指定してください: %d\n", N / 2, J);
+        return 1;
+    }
+    if (n0 < 0 || n0 >= N) {
+        fprintf(stderr, "エラー: シフト量は 0〜%d の範囲で指定してください: %d\n", N - 1, n0);
+        return 1;
+    }
+    if (fs <= 0 || periods < 1) {
+        fprintf(stderr, "エラー: サンプリング周波数と周期数は1以上を指定してください\n");
+        return 1;
+    }
+
     printf("TSP信号を生成中...\n");
     printf("N = %d, J = %d, fs = %d Hz\n", N, J, fs);
+    if (periods > 1) {
+        printf("シフト量 = %d, 周期数 = %d（%lld サンプル, %.3f 秒）\n", n0, periods,
+               (long long)N * periods, (double)N * periods / fs);
+    }
 
     // メモリ確保
     double complex *H = (double complex *)malloc(sizeof(double complex) * N);
@@ -95,7 +172,10 @@ int main() {
     H[N / 2] = creal(H[N / 2]) + 0 * I;
 
     // 2. 逆フーリエ変換 (IFFT) で時間領域へ
-    simple_ifft(H, N);
+    fft_plan *plan = fft_plan_create(N);
+    if (!plan) { fprintf(stderr, "FFT plan error\n"); free(H); return 1; }
+    fft_execute(plan, H, FFT_INVERSE);
+    fft_plan_destroy(plan);
 
     // 3. 最大値で正規化（クリッピング防止）
     double max_amp = 0;
@@ -104,37 +184,52 @@ int main() {
     }
 
     // 4. WAVファイルとして書き出し
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) { perror("File error"); return 1; }
-
-    WavHeader head;
-    memcpy(head.riff, "RIFF", 4);
-    head.chunk_size = 36 + N * 2;
-    memcpy(head.wave, "WAVE", 4);
-    memcpy(head.fmt, "fmt ", 4);
-    head.fmt_size = 16;
-    head.audio_format = 1;
-    head.num_channels = 1;
-    head.sample_rate = fs;
-    head.bits_per_sample = 16;
-    head.byte_rate = fs * 2;
-    head.block_align = 2;
-    memcpy(head.data, "data", 4);
-    head.data_size = N * 2;
-
-    fwrite(&head, sizeof(WavHeader), 1, fp);
-
-    for (int i = 0; i < N; i++) {
-        // -1.0〜1.0 の実数部を 16bit整数 (-32768〜32767) に変換
-        // マージンとして0.9を掛けています
-        double sample = creal(H[i]) / max_amp * 0.9;
-        short pcm = (short)(sample * 32767.0);
-        fwrite(&pcm, 2, 1, fp);
+    // 1周期分を出力形式のバッファに変換し、それを periods 回繰り返して書き込む
+    // （IFFT は1周期分の1回だけ）
+    // マージンとして0.9を掛けています
+    int16_t *pcm = NULL;
+    float *samples = NULL;
+    if (out_format == WAV_FORMAT_PCM16) {
+        pcm = (int16_t *)malloc(N * sizeof(int16_t));
+        if (!pcm) { fprintf(stderr, "Memory error\n"); free(H); return 1; }
+        for (int i = 0; i < N; i++) {
+            // -1.0〜1.0 の実数部を 16bit整数 (-32768〜32767) に変換
+            double sample = creal(H[i]) / max_amp * 0.9;
+            pcm[i] = (int16_t)(sample * 32767.0);
+        }
+    } else {
+        samples = (float *)malloc(N * sizeof(float));
+        if (!samples) { fprintf(stderr, "Memory error\n"); free(H); return 1; }
+        for (int i = 0; i < N; i++) {
+            samples[i] = (float)(creal(H[i]) / max_amp * 0.9);
+        }
     }
-
-    fclose(fp);
     free(H);
 
+    WavWriter writer;
+    int status = wav_writer_open_sized(filename, &writer, fs, out_format, (int64_t)N * periods);
+    for (int p = 0; p < periods && status == 0; p++) {
+        status = pcm ? wav_writer_write(&writer, pcm, N)
+                     : wav_writer_write_float(&writer, samples, N);
+    }
+    if (status == 0) {
+        status = wav_writer_close(&writer);
+    } else if (writer.fp) {
+        wav_writer_close(&writer);
+    }
+    if (status < 0) {
+        fprintf(stderr, "エラー: WAVファイルの書き込みに失敗\n");
+        free(pcm);
+        free(samples);
+        return 1;
+    }
     printf("完了: %s を保存しました。\n", filename);
-    return 0;
-}
\ No newline at end of file
+
+    // 5. 逆フィルタのサイドカーを書き出し
+    if (write_inverse) {
+        status = write_inverse_sidecar(filename, pcm, samples, N, J, n0);
+    }
+    free(pcm);
+    free(samples);
+    return (status == 0) ? 0 : 1;
+}
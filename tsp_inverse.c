@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tsp_inverse.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// ファイル先頭の識別子
+#define TSP_INVERSE_MAGIC "TSPINV02"
+
+/*
+ * ファイル上のヘッダ（40バイト、リトルエンディアン）
+ * 続いて double complex の逆フィルタ num_bins 個、マスク num_bins バイトを置く。
+ * ヘッダ長が8の倍数なので、mmap した領域上で逆フィルタはそのまま整列している。
+ */
+typedef struct {
+    char magic[8];
+    int32_t n;
+    int32_t j;
+    int32_t shift;
+    int32_t num_bins;
+    uint64_t hash;
+    uint64_t params;
+} TspInverseHeader;
+
+uint64_t tsp_hash(const void *data, size_t size) {
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+void tsp_inverse_compute(double complex *inverse, int n, int j) {
+    // down-TSP: exp(+j * 2πJ * (k/N)^2)
+    for (int k = 0; k <= n / 2; k++) {
+        double theta = 2.0 * M_PI * j * pow((double)k / n, 2);
+        inverse[k] = cos(theta) + I * sin(theta);
+    }
+    // Nyquist周波数の虚数部は0
+    inverse[n / 2] = creal(inverse[n / 2]) + 0 * I;
+}
+
+void tsp_inverse_expand(double complex *inverse, int n, const TspInverse *inv) {
+    tsp_inverse_compute(inverse, n, inv->j);
+    for (int k = 0; k <= n / 2; k++) {
+        int64_t src = ((int64_t)k * inv->n + n / 2) / n;
+        if (src >= inv->num_bins) src = inv->num_bins - 1;
+        if (!inv->mask[src]) inverse[k] = 0.0;
+    }
+}
+
+void tsp_inverse_regularized(double complex *inverse, const double complex *spectrum, int n, int fs,
+                             double eps, double f_lo, double f_hi) {
+    int num_bins = n / 2 + 1;
+    double max_power = 0;
+    for (int k = 0; k < num_bins; k++) {
+        double power = creal(spectrum[k]) * creal(spectrum[k]) + cimag(spectrum[k]) * cimag(spectrum[k]);
+        if (power > max_power) max_power = power;
+    }
+    if (max_power == 0) max_power = 1; // 無音の場合も0除算しない
+
+    for (int k = 0; k < num_bins; k++) {
+        // 帯域外の重み w（帯域端からのオクターブ数で 0→1）
+        double f = (double)k * fs / n;
+        double octaves = 0;
+        if (f < f_lo) {
+            octaves = (f > 0) ? log2(f_lo / f) : 1;
+        } else if (f > f_hi) {
+            octaves = log2(f / f_hi);
+        }
+        if (octaves > 1) octaves = 1;
+        double w = 0.5 - 0.5 * cos(M_PI * octaves);
+
+        double complex s = spectrum[k];
+        double power = creal(s) * creal(s) + cimag(s) * cimag(s);
+        double lambda = max_power * (eps + (1.0 - eps) * w);
+        inverse[k] = conj(s) / (power + lambda);
+    }
+}
+
+uint64_t tsp_inverse_params(int fs, double eps, double f_lo, double f_hi) {
+    double values[4] = { (double)fs, eps, f_lo, f_hi };
+    uint64_t h = tsp_hash(values, sizeof(values));
+    return h ? h : 1;
+}
+
+int tsp_inverse_path(char *buf, size_t size, const char *tsp_file, const char *suffix) {
+    int len = snprintf(buf, size, "%s%s", tsp_file, suffix);
+    if (len < 0 || (size_t)len >= size) {
+        fprintf(stderr, "エラー: ファイル名が長すぎます: %s\n", tsp_file);
+        return -1;
+    }
+    return 0;
+}
+
+int tsp_inverse_write(const char *path, int n, int j, int shift, uint64_t hash, uint64_t params,
+                      const double complex *inverse, const unsigned char *mask) {
+    TspInverseHeader head;
+    memcpy(head.magic, TSP_INVERSE_MAGIC, 8);
+    head.n = n;
+    head.j = j;
+    head.shift = shift;
+    head.num_bins = n / 2 + 1;
+    head.hash = hash;
+    head.params = params;
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "エラー: %s を開けません\n", path);
+        return -1;
+    }
+    size_t num_bins = (size_t)head.num_bins;
+    int ok = fwrite(&head, sizeof(head), 1, fp) == 1 &&
+             fwrite(inverse, sizeof(double complex), num_bins, fp) == num_bins &&
+             fwrite(mask, 1, num_bins, fp) == num_bins;
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "エラー: %s への書き込みに失敗\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int tsp_inverse_open(const char *path, TspInverse *inv) {
+    memset(inv, 0, sizeof(TspInverse));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) fprintf(stderr, "警告: %s を開けません\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(TspInverseHeader)) {
+        fprintf(stderr, "警告: %s は逆フィルタのファイルではありません\n", path);
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // マッピングはファイルを閉じても残る
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "警告: %s を読み込めません\n", path);
+        return -1;
+    }
+
+    TspInverseHeader head;
+    memcpy(&head, map, sizeof(head));
+    size_t num_bins = (size_t)head.num_bins;
+    if (memcmp(head.magic, TSP_INVERSE_MAGIC, 8) != 0 || head.n < 2 || head.num_bins != head.n / 2 + 1 ||
+        size != sizeof(head) + num_bins * (sizeof(double complex) + 1)) {
+        fprintf(stderr, "警告: %s は逆フィルタのファイルではありません\n", path);
+        munmap(map, size);
+        return -1;
+    }
+
+    const char *base = (const char *)map;
+    inv->n = head.n;
+    inv->j = head.j;
+    inv->shift = head.shift;
+    inv->num_bins = head.num_bins;
+    inv->hash = head.hash;
+    inv->params = head.params;
+    inv->inverse = (const double complex *)(base + sizeof(head));
+    inv->mask = (const unsigned char *)(base + sizeof(head) + num_bins * sizeof(double complex));
+    inv->map = map;
+    inv->map_size = size;
+    return 0;
+}
+
+void tsp_inverse_close(TspInverse *inv) {
+    if (inv->map) munmap(inv->map, inv->map_size);
+    memset(inv, 0, sizeof(TspInverse));
+}
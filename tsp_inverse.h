@@ -0,0 +1,86 @@
+#ifndef TSP_INVERSE_H
+#define TSP_INVERSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <complex.h>
+
+/*
+ * 逆フィルタ（down-TSP）のサイドカーファイル
+ * tsp_gen が TSP 信号と一緒に書き出し、tsp_to_ir が mmap で読み込む。
+ * 逆フィルタのスペクトル（0〜N/2 の N/2+1 ビン）と有効ビンのマスクを保持し、
+ * N / J / シフト量と TSP 1周期分のデータのハッシュで対応する TSP を確認する。
+ * 同じ TSP で測定を繰り返す場合に、TSP の FFT と逆フィルタの計算を省ける。
+ * tsp_to_ir --inverse measured が作る実測スペクトルの正則化逆フィルタも同じ形式で
+ * キャッシュし、params に正則化パラメータのハッシュを入れて区別する（理論値は0）。
+ */
+typedef struct {
+    int n;                          // FFT長（TSP の1周期の長さ）
+    int j;                          // 実行長
+    int shift;                      // 巡回シフト量
+    int num_bins;                   // ビン数（n/2+1）
+    uint64_t hash;                  // TSP 1周期分のデータ（ファイル上の形式）のハッシュ
+    uint64_t params;                // 逆フィルタの作り方（0: 理論値、それ以外: 正則化パラメータのハッシュ）
+    const double complex *inverse;  // 逆フィルタ（マスク適用済み）
+    const unsigned char *mask;      // 1: 有効なビン、0: TSP のスペクトルが小さく除外したビン
+    void *map;                      // mmap 領域
+    size_t map_size;
+} TspInverse;
+
+/**
+ * TSP データのハッシュ（64bit FNV-1a）
+ */
+uint64_t tsp_hash(const void *data, size_t size);
+
+/**
+ * 理論上の逆フィルタ exp(+j 2πJ (k/n)^2) を 0〜n/2 の n/2+1 ビンについて計算
+ */
+void tsp_inverse_compute(double complex *inverse, int n, int j);
+
+/**
+ * サイドカーの J とマスクから n 点の理論上の逆フィルタを作る（n/2+1 ビン）
+ * 応答が1周期より長く FFT 長 n がサイドカーの長さと違う場合に使い、TSP の FFT を省く。
+ * n 点のビン k には、同じ周波数に最も近いサイドカーのビンのマスクを使う。
+ */
+void tsp_inverse_expand(double complex *inverse, int n, const TspInverse *inv);
+
+/**
+ * 実測スペクトル S から正則化した逆フィルタ conj(S) / (|S|^2 + λ(k)) を計算
+ * λ(k) = max|S|^2 * (eps + (1 - eps) * w(f))。w は帯域 [f_lo, f_hi] 内で0、
+ * 帯域端から1オクターブかけて余弦状に1まで上がる（帯域外の増幅を抑える）。
+ * spectrum と inverse は同じ配列でもよい（要素数は n/2+1）。
+ */
+void tsp_inverse_regularized(double complex *inverse, const double complex *spectrum, int n, int fs,
+                             double eps, double f_lo, double f_hi);
+
+/**
+ * 正則化パラメータのハッシュ（キャッシュの params に使う、0にはならない）
+ */
+uint64_t tsp_inverse_params(int fs, double eps, double f_lo, double f_hi);
+
+/**
+ * TSP 信号のファイル名からサイドカーのファイル名を作る（"tsp.wav" + ".inv" → "tsp.wav.inv"）
+ * 戻り値: 0、buf に収まらない場合は-1
+ */
+int tsp_inverse_path(char *buf, size_t size, const char *tsp_file, const char *suffix);
+
+/**
+ * サイドカーを書き出す（inverse はマスク適用済み、要素数はいずれも n/2+1）
+ * 戻り値: 0、エラー時は-1
+ */
+int tsp_inverse_write(const char *path, int n, int j, int shift, uint64_t hash, uint64_t params,
+                      const double complex *inverse, const unsigned char *mask);
+
+/**
+ * サイドカーを mmap で開く
+ * ファイルが無い場合は何も表示せずに-1を返す（サイドカーは任意のため）。
+ * 戻り値: 0、エラー時は-1
+ */
+int tsp_inverse_open(const char *path, TspInverse *inv);
+
+/**
+ * tsp_inverse_open で開いたサイドカーを閉じる
+ */
+void tsp_inverse_close(TspInverse *inv);
+
+#endif
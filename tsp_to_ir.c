@@ -4,370 +4,1904 @@
 #include <math.h>
 #include <complex.h>
 #include <string.h>
+#include <stdatomic.h>
+
+#include "fft.h"
+#include "manifest.h"
+#include "parallel.h"
+#include "resample.h"
+#include "tsp_inverse.h"
+#include "wav_io.h"
+
+// FFT長の上限（fft_plan は int で長さを持つ）
+#define FFT_MAX_LEN (1 << 30)
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-// WAVヘッダ構造体（44バイト）
-#pragma pack(push, 1)
-typedef struct {
-    char riff[4];           // "RIFF"
-    int chunk_size;         // ファイルサイズ - 8
-    char wave[4];           // "WAVE"
-    char fmt[4];            // "fmt "
-    int fmt_size;           // 16 (PCM)
-    short audio_format;     // 1 (PCM)
-    short num_channels;     // 1 (Mono)
-    int sample_rate;        // 48000
-    int byte_rate;          // sample_rate * channels * bits/8
-    short block_align;      // channels * bits/8
-    short bits_per_sample;  // 16
-    char data[4];           // "data"
-    int data_size;          // 波形データサイズ (N * 2 bytes)
-} WavHeader;
-#pragma pack(pop)
+// 応答を読み込んで平均する際のブロック長
+#define AVERAGE_BLOCK 65536
+
+// 外れ値に強い合成で全スレッド・全テイクが持つ読み込みブロックの合計（サンプル数）と、
+// テイクが多い場合のブロック長の下限
+#define COMBINE_BUFFER_SAMPLES (1 << 22)
+#define COMBINE_MIN_BLOCK 1024
+
+// ドリフト補正の補間フィルタ（タップ数と小数位置の分割数）
+#define DRIFT_TAPS 32
+#define DRIFT_PHASES 512
+
+// 出力IRの自動切り詰め: 包絡線を求める窓長 [秒] と、雑音レベルからの余裕 [dB]
+#define TRIM_WINDOW_SEC 0.01
+#define TRIM_MARGIN_DB 5.0
+
+// --truncate / --length で --predelay を省略したときの、ピークより前に残す長さ [ms]
+#define TRIM_DEFAULT_PREDELAY_MS 1.0
+
+// 残差がテイクの中央値よりこれ以上大きいテイクを外れ値として報告する [dB]
+#define OUTLIER_DB 6.0
+
+// テイクの合成方法（--combine）
+enum {
+    COMBINE_MEAN,       // 算術平均
+    COMBINE_TRIMMED,    // サンプルごとに上下を除いた平均
+    COMBINE_MEDIAN,     // サンプルごとの中央値
+    COMBINE_WEIGHTED    // テイクの残差パワーの逆数で重み付け
+};
 
 /**
- * WAVファイルを読み込む
- * 戻り値: 読み込んだサンプル数、エラー時は-1
+ * 理論上の逆フィルタ（down-TSP）を計算（倍精度）
+ * TSP信号をFFTし、スペクトルが十分小さいビンは 0 にする。
+ * 戻り値: N/2+1 ビンの逆フィルタ（呼び出し側で free）
  */
-int read_wav(const char *filename, int16_t **samples, int *fs) {
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        fprintf(stderr, "エラー: %s を開けません\n", filename);
-        return -1;
+static double complex *build_inverse(const fft_plan *plan, const float *tsp_samples, int tsp_len,
+                                     int N, int J) {
+    // 4. TSP信号をFFT
+    // 実数信号なので実数入力FFTを使い、0〜N/2 の N/2+1 ビンのみ保持する
+    int num_bins = N / 2 + 1;
+    double complex *TSP = (double complex *)calloc(num_bins, sizeof(double complex));
+    double *tsp_time = (double *)TSP;
+    for (int i = 0; i < tsp_len; i++) {
+        tsp_time[i] = tsp_samples[i];
     }
+    fft_execute_r2c(plan, TSP);
 
-    WavHeader header;
-    if (fread(&header, sizeof(WavHeader), 1, fp) != 1) {
-        fprintf(stderr, "エラー: WAVヘッダの読み込みに失敗\n");
-        fclose(fp);
-        return -1;
+    // 5. 逆フィルタを計算（down-TSP）
+    // 負の周波数側は共役対称なので 0〜N/2 のみ計算する
+    // TSP信号のスペクトルが十分小さいビンは 0 にしておく
+    double complex *INV_FILTER = (double complex *)malloc(num_bins * sizeof(double complex));
+    tsp_inverse_compute(INV_FILTER, N, J);
+    for (int k = 0; k < num_bins; k++) {
+        if (cabs(TSP[k]) <= 1e-10) INV_FILTER[k] = 0.0;
     }
+    free(TSP);
+    return INV_FILTER;
+}
 
-    // WAV形式のチェック
-    if (memcmp(header.riff, "RIFF", 4) != 0 || 
-        memcmp(header.wave, "WAVE", 4) != 0 ||
-        memcmp(header.fmt, "fmt ", 4) != 0 ||
-        memcmp(header.data, "data", 4) != 0) {
-        fprintf(stderr, "エラー: 無効なWAVファイル\n");
-        fclose(fp);
-        return -1;
+/**
+ * TSP信号と平均化した応答からインパルス応答を算出（倍精度）
+ * 入力は -1.0〜1.0 の実数。応答は channels チャンネル分を受け取り、
+ * TSP信号のFFTと逆フィルタは全チャンネルで共有する。
+ * plan: N 点の実数FFTプラン（呼び出し側で作成し、一括処理では全ジョブで共有）
+ * inverse: tsp_gen のサイドカーから読み込んだ、または一括処理で先に計算した
+ *          N/2+1 ビンの逆フィルタ（マスク適用済み）。NULL の場合は実効長 J からここで計算する。
+ * 出力: irs[c] に N サンプルのIR（呼び出し側で free）。チャンネル間の
+ *       レベル差を保つため、全チャンネル共通の最大値で正規化する。
+ * 戻り値: 0、エラー時は-1
+ */
+static int compute_ir(const fft_plan *plan, const float *tsp_samples, int tsp_len, int J,
+                      const double complex *inverse,
+                      float *const *responses, int channels, int64_t response_len, int N,
+                      float **irs) {
+    int num_bins = N / 2 + 1;
+    double complex *INV_FILTER = NULL;
+    if (!inverse) {
+        INV_FILTER = build_inverse(plan, tsp_samples, tsp_len, N, J);
+        inverse = INV_FILTER;
     }
 
-    *fs = header.sample_rate;
-    int num_samples = header.data_size / 2; // 16bit = 2 bytes
+    // 6. チャンネルごとにTSP応答をFFT（2周期目を切り出す想定）
+    // 実際の測定では2周期再生して2周期目を切り出す必要がある
+    double complex *IR_FREQ = (double complex *)malloc(num_bins * sizeof(double complex));
+    double *response_time = (double *)IR_FREQ;
+    int64_t start_idx = (response_len >= (int64_t)tsp_len * 2) ? tsp_len : 0; // 2周期目があれば使用
+    int copy_len = (response_len - start_idx < N) ? (int)(response_len - start_idx) : N;
+    double max_amp = 0;
+    for (int c = 0; c < channels; c++) {
+        memset(IR_FREQ, 0, num_bins * sizeof(double complex));
+        for (int i = 0; i < copy_len; i++) {
+            response_time[i] = responses[c][start_idx + i];
+        }
+        fft_execute_r2c(plan, IR_FREQ);
+
+        // 7. 周波数領域で除算（逆フィルタ適用）
+        // H(k) = Y(k) / S(k) = Y(k) * INV_FILTER(k)
+        for (int k = 0; k < num_bins; k++) {
+            IR_FREQ[k] *= inverse[k];
+        }
 
-    *samples = (int16_t *)malloc(num_samples * sizeof(int16_t));
-    if (!*samples) {
-        fprintf(stderr, "エラー: メモリ確保に失敗\n");
-        fclose(fp);
-        return -1;
+        // 8. IFFTで時間領域に戻す（実数出力IFFT）
+        fft_execute_c2r(plan, IR_FREQ);
+        double *ir_time = (double *)IR_FREQ;
+
+        irs[c] = (float *)malloc(N * sizeof(float));
+        for (int i = 0; i < N; i++) {
+            double amp = fabs(ir_time[i]);
+            if (amp > max_amp) max_amp = amp;
+            irs[c][i] = (float)ir_time[i];
+        }
     }
 
-    if (fread(*samples, sizeof(int16_t), num_samples, fp) != num_samples) {
-        fprintf(stderr, "エラー: データの読み込みに失敗\n");
-        free(*samples);
-        fclose(fp);
-        return -1;
+    // 9. 最大値で正規化
+    double gain = 0.9 / max_amp;
+    for (int c = 0; c < channels; c++) {
+        for (int i = 0; i < N; i++) {
+            irs[c][i] = (float)(irs[c][i] * gain);
+        }
     }
 
-    fclose(fp);
-    return num_samples;
+    free(INV_FILTER);
+    free(IR_FREQ);
+    return 0;
 }
 
 /**
- * 簡易FFT (Radix-2)
+ * TSP信号と平均化した応答からインパルス応答を算出（単精度、--precision float）
+ * 引数と戻り値は compute_ir と同じ（plan は単精度の N 点実数FFTプラン）。
  */
-void simple_fft(double complex *x, int n) {
-    // ビット反転並べ替え
-    for (int i = 1, j = 0; i < n; i++) {
-        int bit = n >> 1;
-        for (; j & bit; bit >>= 1) j ^= bit;
-        j ^= bit;
-        if (i < j) {
-            double complex t = x[i]; x[i] = x[j]; x[j] = t;
-        }
-    }
-    // クーリー・テューキー
-    for (int len = 2; len <= n; len <<= 1) {
-        double ang = 2.0 * M_PI / len;
-        double complex wlen = cos(ang) + I * sin(ang);
-        for (int i = 0; i < n; i += len) {
-            double complex w = 1.0;
-            for (int j = 0; j < len / 2; j++) {
-                double complex u = x[i + j];
-                double complex v = x[i + j + len / 2] * w;
-                x[i + j] = u + v;
-                x[i + j + len / 2] = u - v;
-                w *= wlen;
+static int compute_ir_float(const fft_planf *plan, const float *tsp_samples, int tsp_len, int J,
+                            const double complex *inverse,
+                            float *const *responses, int channels, int64_t response_len, int N,
+                            float **irs) {
+    // 5. 逆フィルタ（down-TSP）
+    // 位相は最大で πJ 程度まで大きくなるため倍精度で計算してから丸める
+    int num_bins = N / 2 + 1;
+    float complex *INV_FILTER = (float complex *)malloc(num_bins * sizeof(float complex));
+    if (inverse) {
+        for (int k = 0; k < num_bins; k++) {
+            INV_FILTER[k] = (float complex)inverse[k];
+        }
+    } else {
+        // 4. TSP信号をFFT
+        // 実数信号なので実数入力FFTを使い、0〜N/2 の N/2+1 ビンのみ保持する
+        float complex *TSP = (float complex *)calloc(num_bins, sizeof(float complex));
+        float *tsp_time = (float *)TSP;
+        for (int i = 0; i < tsp_len; i++) {
+            tsp_time[i] = tsp_samples[i];
+        }
+        fft_execute_r2cf(plan, TSP);
+
+        double complex *theory = (double complex *)malloc(num_bins * sizeof(double complex));
+        tsp_inverse_compute(theory, N, J);
+        for (int k = 0; k < num_bins; k++) {
+            INV_FILTER[k] = (cabsf(TSP[k]) <= 1e-10f) ? 0.0f : (float complex)theory[k];
+        }
+        free(theory);
+        free(TSP);
+    }
+
+    // 6. チャンネルごとにTSP応答をFFT（2周期目を切り出す想定）
+    float complex *IR_FREQ = (float complex *)malloc(num_bins * sizeof(float complex));
+    float *response_time = (float *)IR_FREQ;
+    int64_t start_idx = (response_len >= (int64_t)tsp_len * 2) ? tsp_len : 0; // 2周期目があれば使用
+    int copy_len = (response_len - start_idx < N) ? (int)(response_len - start_idx) : N;
+    float max_amp = 0;
+    for (int c = 0; c < channels; c++) {
+        memset(IR_FREQ, 0, num_bins * sizeof(float complex));
+        for (int i = 0; i < copy_len; i++) {
+            response_time[i] = responses[c][start_idx + i];
+        }
+        fft_execute_r2cf(plan, IR_FREQ);
+
+        // 7. 周波数領域で除算（逆フィルタ適用）
+        for (int k = 0; k < num_bins; k++) {
+            IR_FREQ[k] *= INV_FILTER[k];
+        }
+
+        // 8. IFFTで時間領域に戻す（実数出力IFFT）
+        fft_execute_c2rf(plan, IR_FREQ);
+        float *ir_time = (float *)IR_FREQ;
+
+        irs[c] = (float *)malloc(N * sizeof(float));
+        for (int i = 0; i < N; i++) {
+            float amp = fabsf(ir_time[i]);
+            if (amp > max_amp) max_amp = amp;
+            irs[c][i] = ir_time[i];
+        }
+    }
+
+    // 9. 最大値で正規化
+    float gain = 0.9f / max_amp;
+    for (int c = 0; c < channels; c++) {
+        for (int i = 0; i < N; i++) {
+            irs[c][i] *= gain;
+        }
+    }
+
+    free(INV_FILTER);
+    free(IR_FREQ);
+    return 0;
+}
+
+/**
+ * チャンネルごとの配列をまとめて解放
+ */
+static void free_channels(float **planes, int channels) {
+    if (!planes) return;
+    for (int c = 0; c < channels; c++) free(planes[c]);
+    free(planes);
+}
+
+/**
+ * チャンネルごとの倍精度の配列をまとめて解放
+ */
+static void free_sums(double **planes, int channels) {
+    if (!planes) return;
+    for (int c = 0; c < channels; c++) free(planes[c]);
+    free(planes);
+}
+
+/**
+ * 応答ファイルのヘッダだけを読み、形式をそろえて最短長を求める
+ * 戻り値: 0、エラー時は-1
+ */
+static int check_takes(char **files, int num_files, int fs, int *channels_out, int64_t *len_out) {
+    int channels = 0;
+    int64_t len = 0;
+    for (int f = 0; f < num_files; f++) {
+        WavReader reader;
+        if (wav_reader_open(files[f], &reader) < 0) {
+            fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", files[f]);
+            return -1;
+        }
+        if (f == 0) channels = reader.channels;
+        if (reader.fs != fs || reader.channels != channels) {
+            fprintf(stderr, "エラー: 応答ファイルのサンプリング周波数またはチャンネル数が一致しません (%s: %d Hz, %d ch)\n",
+                    files[f], reader.fs, reader.channels);
+            wav_reader_close(&reader);
+            return -1;
+        }
+        if (f == 0 || reader.num_frames < len) len = reader.num_frames;
+        wav_reader_close(&reader);
+    }
+    *channels_out = channels;
+    *len_out = len;
+    return 0;
+}
+
+/*
+ * テイクの並列読み込み
+ * ファイル列を num_parts 個の連続区間に分け、区間ごとに部分和を作る。
+ */
+typedef struct {
+    char **files;
+    int num_files;
+    int num_parts;
+    int channels;
+    int64_t len;
+    double ***partials;     // partials[t][c]: 区間 t の部分和（倍精度）
+    int *status;            // 区間ごとの結果（0 または -1）
+} TakeSumContext;
+
+/**
+ * 区間 [begin, end) の各部分和を計算（parallel_for から呼ばれる）
+ * 1ファイルずつブロック単位で読みながら、区間の部分和に足し込む。
+ */
+static void sum_takes(void *arg, int begin, int end) {
+    TakeSumContext *ctx = (TakeSumContext *)arg;
+    int channels = ctx->channels;
+    int64_t len = ctx->len;
+
+    for (int t = begin; t < end; t++) {
+        int first = (int)((long long)ctx->num_files * t / ctx->num_parts);
+        int last = (int)((long long)ctx->num_files * (t + 1) / ctx->num_parts);
+        double **sum = (double **)malloc(channels * sizeof(double *));
+        float **blocks = (float **)malloc(channels * sizeof(float *));
+        for (int c = 0; c < channels; c++) {
+            sum[c] = (double *)calloc(len, sizeof(double));
+            blocks[c] = (float *)malloc(AVERAGE_BLOCK * sizeof(float));
+        }
+        ctx->partials[t] = sum;
+        ctx->status[t] = 0;
+
+        for (int f = first; f < last; f++) {
+            WavReader reader;
+            int ok = (wav_reader_open(ctx->files[f], &reader) == 0);
+            for (int64_t done = 0; ok && done < len; done += AVERAGE_BLOCK) {
+                int n = (len - done < AVERAGE_BLOCK) ? (int)(len - done) : AVERAGE_BLOCK;
+                if (wav_reader_read_planar(&reader, blocks, n) != n) {
+                    ok = 0;
+                    break;
+                }
+                for (int c = 0; c < channels; c++) {
+                    double *dst = sum[c] + done;
+                    for (int i = 0; i < n; i++) {
+                        dst[i] += blocks[c][i];
+                    }
+                }
+            }
+            if (reader.fp) wav_reader_close(&reader);
+            if (!ok) {
+                fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", ctx->files[f]);
+                ctx->status[t] = -1;
+                break;
             }
         }
+        free_channels(blocks, channels);
     }
 }
 
 /**
- * 簡易IFFT (Radix-2)
+ * 複数の応答ファイルを時間領域で平均（最短長に揃える）
+ * 平均は実数のまま保持し、16bit へ丸め直さずにFFTへ渡す。
+ * 先にヘッダだけを読んで長さを揃え、その後 num_threads 本のスレッドで
+ * ファイル列を分担して読み込み、スレッドごとの部分和を区間の順に足し合わせる。
+ * 足し合わせる順序はスレッド数だけで決まるため、同じスレッド数なら結果は再現する。
+ * 部分和は倍精度で持ち、テイク数で割ってから最後に1回だけ単精度に丸めるため、
+ * 数百テイクでも加算の丸め誤差は溜まらない。
+ * メモリは部分和（スレッド数分）と読み込みブロック分で、テイク数にはよらない。
+ * 戻り値: チャンネルごとの平均（呼び出し側で free_channels）、エラー時はNULL
  */
-void simple_ifft(double complex *x, int n) {
-    // ビット反転並べ替え
-    for (int i = 1, j = 0; i < n; i++) {
-        int bit = n >> 1;
-        for (; j & bit; bit >>= 1) j ^= bit;
-        j ^= bit;
-        if (i < j) {
-            double complex t = x[i]; x[i] = x[j]; x[j] = t;
-        }
-    }
-    // クーリー・テューキー
-    for (int len = 2; len <= n; len <<= 1) {
-        double ang = -2.0 * M_PI / len; // 逆変換なのでマイナス
-        double complex wlen = cos(ang) + I * sin(ang);
-        for (int i = 0; i < n; i += len) {
-            double complex w = 1.0;
-            for (int j = 0; j < len / 2; j++) {
-                double complex u = x[i + j];
-                double complex v = x[i + j + len / 2] * w;
-                x[i + j] = u + v;
-                x[i + j + len / 2] = u - v;
-                w *= wlen;
-            }
-        }
-    }
-    // 正規化
-    for (int i = 0; i < n; i++) x[i] /= n;
+static float **average_takes(char **files, int num_files, int fs, int num_threads,
+                             int *channels_out, int64_t *len_out) {
+    int channels = 0;
+    int64_t len = 0;
+
+    // 1. ヘッダを確認して最短長を求める
+    if (check_takes(files, num_files, fs, &channels, &len) < 0) return NULL;
+
+    // 2. 区間ごとに部分和を並列に計算
+    // インタリーブされた収録はブロックごとにチャンネル別の配列へ分けてから足し込む
+    int num_parts = (num_threads < num_files) ? num_threads : num_files;
+    if (num_parts < 1) num_parts = 1;
+    TakeSumContext ctx;
+    ctx.files = files;
+    ctx.num_files = num_files;
+    ctx.num_parts = num_parts;
+    ctx.channels = channels;
+    ctx.len = len;
+    ctx.partials = (double ***)calloc(num_parts, sizeof(double **));
+    ctx.status = (int *)calloc(num_parts, sizeof(int));
+    parallel_for(num_parts, num_parts, sum_takes, &ctx);
+
+    // 3. 部分和を区間の順に足し合わせる
+    int status = 0;
+    for (int t = 0; t < num_parts; t++) {
+        if (ctx.status[t] < 0) status = -1;
+    }
+    double **total = ctx.partials[0];
+    for (int t = 1; t < num_parts; t++) {
+        for (int c = 0; c < channels && status == 0; c++) {
+            double *dst = total[c];
+            const double *src = ctx.partials[t][c];
+            for (int64_t i = 0; i < len; i++) {
+                dst[i] += src[i];
+            }
+        }
+        free_sums(ctx.partials[t], channels);
+    }
+    free(ctx.partials);
+    free(ctx.status);
+    if (status < 0) {
+        free_sums(total, channels);
+        return NULL;
+    }
+
+    // 4. テイク数で割って単精度にする（チャンネルごとに変換して部分和を手放す）
+    float **responses = (float **)malloc(channels * sizeof(float *));
+    double scale = 1.0 / num_files;
+    for (int c = 0; c < channels; c++) {
+        responses[c] = (float *)malloc((size_t)len * sizeof(float));
+        for (int64_t i = 0; i < len; i++) {
+            responses[c][i] = (float)(total[c][i] * scale);
+        }
+        free(total[c]);
+        total[c] = NULL;
+    }
+    free(total);
+
+    *channels_out = channels;
+    *len_out = len;
+    return responses;
 }
 
 /**
- * WAVファイルに書き込む
+ * x[0..n-1] のうち小さい方から k 番目（0始まり）の値を選ぶ（quickselect）
+ * 戻ると x[0..k-1] <= x[k] <= x[k+1..n-1] に並んでいる。
+ * 軸は先頭・中央・末尾の中央値で選び、平均 O(n) で求まる。
  */
-int write_wav(const char *filename, int16_t *samples, int num_samples, int fs) {
-    FILE *fp = fopen(filename, "wb");
-    if (!fp) {
-        fprintf(stderr, "エラー: %s を開けません\n", filename);
-        return -1;
+static float select_kth(float *x, int n, int k) {
+    int lo = 0, hi = n - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        float a = x[lo], b = x[mid], c = x[hi];
+        float pivot = (a < b) ? ((b < c) ? b : (a < c) ? c : a)
+                              : ((a < c) ? a : (b < c) ? c : b);
+        int i = lo, j = hi;
+        while (i <= j) {
+            while (x[i] < pivot) i++;
+            while (x[j] > pivot) j--;
+            if (i <= j) {
+                float tmp = x[i]; x[i] = x[j]; x[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        // [lo, j] <= pivot <= [i, hi]、間の要素は pivot に等しい
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;
+        }
     }
+    return x[k];
+}
 
-    WavHeader head;
-    memcpy(head.riff, "RIFF", 4);
-    head.chunk_size = 36 + num_samples * 2;
-    memcpy(head.wave, "WAVE", 4);
-    memcpy(head.fmt, "fmt ", 4);
-    head.fmt_size = 16;
-    head.audio_format = 1;
-    head.num_channels = 1;
-    head.sample_rate = fs;
-    head.bits_per_sample = 16;
-    head.byte_rate = fs * 2;
-    head.block_align = 2;
-    memcpy(head.data, "data", 4);
-    head.data_size = num_samples * 2;
-
-    fwrite(&head, sizeof(WavHeader), 1, fp);
-    fwrite(samples, sizeof(int16_t), num_samples, fp);
-
-    fclose(fp);
-    return 0;
+/*
+ * テイクの合成
+ * 全テイクを mmap で開き、サンプル区間をスレッド数の連続区間に分けて、
+ * 各スレッドが自分の区間をブロック単位で読みながら残差の集計と合成を行う。
+ * マッピングはファイルを閉じても残るため、テイク数によらず開いたままのファイルはない。
+ */
+typedef struct {
+    const WavMap *maps;     // maps[f]: テイク f
+    int num_files;
+    int channels;
+    int64_t len;
+    int num_parts;          // サンプル区間の数（スレッド数）
+    int block;              // 1回に読み込むフレーム数
+    int method;
+    int trim;               // COMBINE_TRIMMED で上下それぞれ除くテイク数
+    const double *weights;  // COMBINE_WEIGHTED の重み（合計1）
+    int score;              // 1: 残差を集計する
+    int merge;              // 1: 合成する
+    double **residual;      // residual[p][f]: 区間 p でのテイク f の残差エネルギー
+    float **out;            // out[c]: 合成結果（長さ len）
+} CombineContext;
+
+/**
+ * n サンプル分を合成
+ * v[t]: テイク t の値、x: テイク数分の作業配列
+ */
+static void combine_samples(const CombineContext *ctx, float *const *v, float *x, float *dst, int n) {
+    int takes = ctx->num_files;
+
+    if (ctx->method == COMBINE_WEIGHTED) {
+        for (int i = 0; i < n; i++) {
+            double sum = 0;
+            for (int t = 0; t < takes; t++) sum += ctx->weights[t] * v[t][i];
+            dst[i] = (float)sum;
+        }
+        return;
+    }
+
+    // サンプルごとにテイク方向の値を作業配列に集め、必要な順位だけを選ぶ
+    if (ctx->method == COMBINE_MEDIAN) {
+        int mid = takes / 2;
+        for (int i = 0; i < n; i++) {
+            for (int t = 0; t < takes; t++) x[t] = v[t][i];
+            float upper = select_kth(x, takes, mid);
+            if (takes & 1) {
+                dst[i] = upper;
+            } else {
+                // 下半分 x[0..mid-1] の最大が mid-1 番目
+                float lower = x[0];
+                for (int t = 1; t < mid; t++) lower = (x[t] > lower) ? x[t] : lower;
+                dst[i] = 0.5f * (lower + upper);
+            }
+        }
+    } else {
+        int first = ctx->trim, last = takes - ctx->trim;
+        double scale = 1.0 / (last - first);
+        for (int i = 0; i < n; i++) {
+            for (int t = 0; t < takes; t++) x[t] = v[t][i];
+            // first 番目で上下に分け、残りの中で last-1 番目を選ぶと [first, last) が中央の値になる
+            select_kth(x, takes, first);
+            select_kth(x + first, takes - first, last - 1 - first);
+            double sum = 0;
+            for (int t = first; t < last; t++) sum += x[t];
+            dst[i] = (float)(sum * scale);
+        }
+    }
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 4) {
-        fprintf(stderr, "使用方法: %s tsp_signal.wav response1.wav [response2.wav ...] impulse_response.wav\n", argv[0]);
-        fprintf(stderr, "応答ファイルは1つ以上指定してください。\n");
-        return 1;
+/**
+ * 区間 [begin, end) の残差の集計と合成（parallel_for から呼ばれる）
+ * 残差はブロックごとのサンプルごとの平均を基準にし、合成と同じ読み込みで求める。
+ */
+static void combine_part(void *arg, int begin, int end) {
+    CombineContext *ctx = (CombineContext *)arg;
+    int takes = ctx->num_files;
+    int channels = ctx->channels;
+    float ***blocks = (float ***)malloc(takes * sizeof(float **));
+    for (int f = 0; f < takes; f++) {
+        blocks[f] = (float **)malloc(channels * sizeof(float *));
+        for (int c = 0; c < channels; c++) blocks[f][c] = (float *)malloc(ctx->block * sizeof(float));
     }
+    float **columns = (float **)malloc(takes * sizeof(float *));
+    float *x = (float *)malloc(takes * sizeof(float));
+    float *mean = (float *)malloc(ctx->block * sizeof(float));
 
-    const char *tsp_file = argv[1];
-    const char *output_file = argv[argc - 1];
-    int num_response_files = argc - 3;
+    for (int p = begin; p < end; p++) {
+        int64_t first = ctx->len * p / ctx->num_parts;
+        int64_t last = ctx->len * (p + 1) / ctx->num_parts;
+        double *residual = ctx->residual[p];
+        for (int64_t done = first; done < last; done += ctx->block) {
+            int n = (last - done < ctx->block) ? (int)(last - done) : ctx->block;
+            for (int f = 0; f < takes; f++) wav_map_read_planar(&ctx->maps[f], done, blocks[f], n);
+            for (int c = 0; c < channels; c++) {
+                if (ctx->score) {
+                    float scale = 1.0f / takes;
+                    memset(mean, 0, n * sizeof(float));
+                    for (int f = 0; f < takes; f++) {
+                        const float *v = blocks[f][c];
+                        for (int i = 0; i < n; i++) mean[i] += v[i] * scale;
+                    }
+                    for (int f = 0; f < takes; f++) {
+                        const float *v = blocks[f][c];
+                        double e = 0;
+                        for (int i = 0; i < n; i++) {
+                            double d = v[i] - mean[i];
+                            e += d * d;
+                        }
+                        residual[f] += e;
+                    }
+                }
+                if (ctx->merge) {
+                    for (int f = 0; f < takes; f++) columns[f] = blocks[f][c];
+                    combine_samples(ctx, columns, x, ctx->out[c] + done, n);
+                }
+            }
+        }
+    }
 
-    /* 出力先が入力ファイルと被っていないか確認（上書き事故防止） */
-    if (strcmp(output_file, tsp_file) == 0) {
-        fprintf(stderr, "エラー: 出力ファイル名がTSP信号と同一です。実験データが上書きされます: %s\n", output_file);
-        return 1;
+    for (int f = 0; f < takes; f++) free_channels(blocks[f], channels);
+    free(blocks);
+    free(columns);
+    free(x);
+    free(mean);
+}
+
+/**
+ * 外れ値に強い方法で複数の応答ファイルを合成（--combine trimmed|median|weighted）
+ * 全テイクを mmap で開いてブロック単位で読み、各テイクの残差エネルギー
+ * （サンプルごとの平均との差）を求めて表示する。中央値との差が OUTLIER_DB を
+ * 超えるテイクは外れ値として報告する。
+ *   trimmed : サンプルごとに上下 trim の割合のテイクを除いて平均
+ *   median  : サンプルごとの中央値
+ *   weighted: 残差エネルギーの逆数で重み付け平均（残差を先に求めるため2回読む）
+ * 中央値とトリム平均はサンプルごとに必要な順位だけを quickselect で選ぶため、
+ * テイク数 T に対して O(T) で、テイク数に上限はない。
+ * 読み込みブロックは全スレッド・全テイクで COMBINE_BUFFER_SAMPLES に収まる長さにする。
+ * 残差は区間ごとに集計して区間の順に足すため、同じスレッド数なら結果は再現する。
+ * 戻り値: チャンネルごとの合成結果（呼び出し側で free_channels）、エラー時はNULL
+ */
+static float **combine_takes(char **files, int num_files, int fs, int num_threads, int method, double trim,
+                             int *channels_out, int64_t *len_out) {
+    int channels = 0;
+    int64_t len = 0;
+    if (check_takes(files, num_files, fs, &channels, &len) < 0) return NULL;
+
+    WavMap *maps = (WavMap *)calloc(num_files, sizeof(WavMap));
+    int status = 0;
+    for (int f = 0; f < num_files && status == 0; f++) {
+        if (wav_map_open(files[f], &maps[f]) < 0) {
+            fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", files[f]);
+            status = -1;
+        }
     }
-    for (int i = 0; i < num_response_files; i++) {
-        if (strcmp(output_file, argv[2 + i]) == 0) {
-            fprintf(stderr, "エラー: 出力ファイル名が応答ファイルと同一です。実験データが上書きされます: %s\n", output_file);
-            return 1;
+
+    CombineContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.maps = maps;
+    ctx.num_files = num_files;
+    ctx.channels = channels;
+    ctx.len = len;
+    ctx.num_parts = (num_threads > 0) ? num_threads : parallel_num_cpus();
+    if (ctx.num_parts > len) ctx.num_parts = (len > 0) ? (int)len : 1;
+    int64_t block = COMBINE_BUFFER_SAMPLES / ((int64_t)ctx.num_parts * num_files * channels);
+    if (block > AVERAGE_BLOCK) block = AVERAGE_BLOCK;
+    if (block < COMBINE_MIN_BLOCK) block = COMBINE_MIN_BLOCK;
+    ctx.block = (int)block;
+    ctx.method = method;
+    ctx.trim = (int)(trim * num_files);
+    if (ctx.trim * 2 >= num_files) ctx.trim = (num_files - 1) / 2;
+    double *weights = (double *)calloc(num_files, sizeof(double));
+    double *residual = (double *)calloc(num_files, sizeof(double));
+    ctx.weights = weights;
+    ctx.residual = (double **)malloc(ctx.num_parts * sizeof(double *));
+    for (int p = 0; p < ctx.num_parts; p++) ctx.residual[p] = (double *)calloc(num_files, sizeof(double));
+    ctx.out = (float **)malloc(channels * sizeof(float *));
+    for (int c = 0; c < channels; c++) ctx.out[c] = (float *)malloc(len * sizeof(float));
+
+    // 重み付けは残差が分かってから合成するため、評価と合成を別々の読み込みで行う
+    if (status == 0) {
+        ctx.score = 1;
+        ctx.merge = (method != COMBINE_WEIGHTED);
+        parallel_for(ctx.num_parts, ctx.num_parts, combine_part, &ctx);
+        for (int p = 0; p < ctx.num_parts; p++) {
+            for (int f = 0; f < num_files; f++) residual[f] += ctx.residual[p][f];
         }
     }
 
-    printf("TSP信号からインパルス応答を算出中...\n");
-    printf("TSP信号: %s\n", tsp_file);
-    printf("TSP応答: %d ファイル", num_response_files);
-    for (int i = 0; i < num_response_files; i++) printf(" %s%s", argv[2 + i], (i < num_response_files - 1) ? "," : "");
-    printf("\n出力: %s\n", output_file);
-
-    // 1. TSP信号を読み込む
-    int16_t *tsp_samples = NULL;
-    int fs_tsp;
-    int tsp_len = read_wav(tsp_file, &tsp_samples, &fs_tsp);
-    if (tsp_len < 0) {
-        fprintf(stderr, "エラー: TSP信号の読み込みに失敗\n");
-        return 1;
+    // テイクごとの評価（残差の中央値に対する比）
+    if (status == 0) {
+        double *sorted = (double *)malloc(num_files * sizeof(double));
+        memcpy(sorted, residual, num_files * sizeof(double));
+        for (int i = 1; i < num_files; i++) {
+            for (int k = i; k > 0 && sorted[k - 1] > sorted[k]; k--) {
+                double tmp = sorted[k]; sorted[k] = sorted[k - 1]; sorted[k - 1] = tmp;
+            }
+        }
+        double median = sorted[num_files / 2];
+        free(sorted);
+
+        double total = 0;
+        for (int f = 0; f < num_files; f++) {
+            // 残差0のテイク（同一ファイルなど）も扱えるよう下限を設ける
+            double r = residual[f] + 1e-30;
+            weights[f] = 1.0 / r;
+            total += weights[f];
+        }
+        for (int f = 0; f < num_files; f++) {
+            weights[f] /= total;
+            double rel = 10.0 * log10((residual[f] + 1e-30) / (median + 1e-30));
+            double rms = sqrt(residual[f] / ((double)len * channels));
+            printf("テイク %d: %s 残差 %.1f dBFS（中央値比 %+.1f dB", f + 1, files[f],
+                   20.0 * log10(rms + 1e-30), rel);
+            if (method == COMBINE_WEIGHTED) printf("、重み %.3f", weights[f]);
+            printf("）%s\n", (num_files > 2 && rel > OUTLIER_DB) ? " ← 外れ値の可能性" : "");
+        }
+    }
+    if (status == 0 && method == COMBINE_WEIGHTED) {
+        ctx.score = 0;
+        ctx.merge = 1;
+        parallel_for(ctx.num_parts, ctx.num_parts, combine_part, &ctx);
+    }
+
+    for (int f = 0; f < num_files; f++) {
+        if (maps[f].data) wav_map_close(&maps[f]);
+    }
+    free(maps);
+    for (int p = 0; p < ctx.num_parts; p++) free(ctx.residual[p]);
+    free(ctx.residual);
+    free(residual);
+    free(weights);
+    if (status < 0) {
+        free_channels(ctx.out, channels);
+        return NULL;
+    }
+    *channels_out = channels;
+    *len_out = len;
+    return ctx.out;
+}
+
+/**
+ * 応答ファイルを先頭から frames フレーム、チャンネルごとの配列に読み込む
+ * 戻り値: 0、エラー時は-1
+ */
+static int read_take(const char *file, int channels, int64_t frames, float **planes) {
+    WavReader reader;
+    if (wav_reader_open(file, &reader) < 0) return -1;
+    float **dst = (float **)malloc(channels * sizeof(float *));
+    int status = 0;
+    for (int64_t done = 0; done < frames; done += AVERAGE_BLOCK) {
+        int n = (frames - done < AVERAGE_BLOCK) ? (int)(frames - done) : AVERAGE_BLOCK;
+        for (int c = 0; c < channels; c++) dst[c] = planes[c] + done;
+        if (wav_reader_read_planar(&reader, dst, n) != n) {
+            status = -1;
+            break;
+        }
+    }
+    free(dst);
+    wav_reader_close(&reader);
+    return status;
+}
+
+/**
+ * 1テイク目を基準に各テイクの遅延を推定し、揃えてから平均（--align）
+ * 相互相関は周波数領域で X(k) conj(R(k)) を逆変換して求め、|ずれ| <= max_lag の
+ * 範囲のピークを放物線補間して小数サンプル単位の遅延 d を得る。多チャンネルは
+ * 全チャンネルの和で遅延を推定し、全チャンネルを同じだけずらす。
+ * ずらしは位相回転 exp(-j 2πkd/M) を掛けて周波数領域で足し込むため、テイクあたり
+ * チャンネル数分のFFTと相関のIFFT 1回で済み、最後にチャンネルごとに1回だけ逆変換する。
+ * FFT長 M は max_lag 分の余白を取り、巡回シフトで反対側のデータが回り込まないようにする。
+ * 戻り値: チャンネルごとの平均（呼び出し側で free_channels）、エラー時はNULL
+ */
+static float **align_takes(char **files, int num_files, int fs, int max_lag,
+                           int *channels_out, int64_t *len_out) {
+    int channels = 0;
+    int64_t len = 0;
+    if (check_takes(files, num_files, fs, &channels, &len) < 0) return NULL;
+    if (len + max_lag > FFT_MAX_LEN) {
+        fprintf(stderr, "エラー: 応答が長すぎます（FFT長の上限は %d サンプル）\n", FFT_MAX_LEN);
+        return NULL;
+    }
+    int M = 2 * fft_next_fast_size((int)((len + max_lag + 1) / 2));
+    int num_bins = M / 2 + 1;
+    if (max_lag > M / 2 - 1) max_lag = M / 2 - 1;
+
+    // FFTプラン（テイク・相関・平均の変換で共有）
+    fft_plan *plan = fft_plan_create_real(M);
+    if (!plan) {
+        fprintf(stderr, "エラー: FFTプランの生成に失敗\n");
+        return NULL;
+    }
+    float **take = (float **)malloc(channels * sizeof(float *));
+    double complex **spec = (double complex **)malloc(channels * sizeof(double complex *));
+    double complex **acc = (double complex **)malloc(channels * sizeof(double complex *));
+    for (int c = 0; c < channels; c++) {
+        take[c] = (float *)malloc(len * sizeof(float));
+        spec[c] = (double complex *)malloc(num_bins * sizeof(double complex));
+        acc[c] = (double complex *)calloc(num_bins, sizeof(double complex));
     }
-    printf("TSP信号: %d サンプル, fs = %d Hz\n", tsp_len, fs_tsp);
-
-    // 2. 複数のTSP応答を読み込み、時間領域で平均化
-    int16_t **response_buffers = (int16_t **)malloc(num_response_files * sizeof(int16_t *));
-    int *response_lengths = (int *)malloc(num_response_files * sizeof(int));
-    int fs_response = 0;
-    int min_response_len = 0;
-
-    for (int f = 0; f < num_response_files; f++) {
-        int fs_file;
-        int len = read_wav(argv[2 + f], &response_buffers[f], &fs_file);
-        if (len < 0) {
-            fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", argv[2 + f]);
-            for (int j = 0; j < f; j++) free(response_buffers[j]);
-            free(response_buffers);
-            free(response_lengths);
-            free(tsp_samples);
-            return 1;
+    double complex *ref = (double complex *)malloc(num_bins * sizeof(double complex));
+    double complex *corr = (double complex *)malloc(num_bins * sizeof(double complex));
+
+    int status = 0;
+    for (int f = 0; f < num_files && status == 0; f++) {
+        if (read_take(files[f], channels, len, take) < 0) {
+            fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", files[f]);
+            status = -1;
+            break;
+        }
+
+        // 1. 各チャンネルをFFTし、その和（全チャンネルの和の信号のスペクトル）を作る
+        memset(corr, 0, num_bins * sizeof(double complex));
+        for (int c = 0; c < channels; c++) {
+            memset(spec[c], 0, num_bins * sizeof(double complex));
+            double *x = (double *)spec[c];
+            for (int64_t i = 0; i < len; i++) x[i] = take[c][i];
+            fft_execute_r2c(plan, spec[c]);
+            for (int k = 0; k < num_bins; k++) corr[k] += spec[c][k];
         }
+
+        // 2. 基準（1テイク目）との相互相関のピークから遅延を求める
+        double lag = 0;
         if (f == 0) {
-            fs_response = fs_file;
-        } else if (fs_response != fs_file) {
-            fprintf(stderr, "エラー: 応答ファイルのサンプリング周波数が一致しません (%s: %d Hz)\n", argv[2 + f], fs_file);
-            for (int j = 0; j <= f; j++) free(response_buffers[j]);
-            free(response_buffers);
-            free(response_lengths);
-            free(tsp_samples);
-            return 1;
-        }
-        response_lengths[f] = len;
-        if (f == 0 || len < min_response_len) min_response_len = len;
-    }
-
-    if (fs_tsp != fs_response) {
-        fprintf(stderr, "エラー: サンプリング周波数が一致しません (TSP: %d, 応答: %d)\n", fs_tsp, fs_response);
-        for (int f = 0; f < num_response_files; f++) free(response_buffers[f]);
-        free(response_buffers);
-        free(response_lengths);
-        free(tsp_samples);
-        return 1;
+            for (int k = 0; k < num_bins; k++) ref[k] = conj(corr[k]);
+        } else {
+            for (int k = 0; k < num_bins; k++) corr[k] *= ref[k];
+            fft_execute_c2r(plan, corr);
+            const double *r = (const double *)corr;
+            int best = 0;
+            for (int l = -max_lag; l <= max_lag; l++) {
+                if (r[(l + M) % M] > r[(best + M) % M]) best = l;
+            }
+            double y0 = r[(best - 1 + M) % M], y1 = r[(best + M) % M], y2 = r[(best + 1 + M) % M];
+            double denom = y0 - 2.0 * y1 + y2;
+            double frac = (denom < 0) ? 0.5 * (y0 - y2) / denom : 0;
+            lag = best + frac;
+            if (best == -max_lag || best == max_lag) {
+                fprintf(stderr, "警告: %s のずれが探索範囲 ±%d サンプルの端です（--max-lag を確認してください）\n",
+                        files[f], max_lag);
+            }
+        }
+        printf("テイク %d: %s ずれ %+.2f サンプル\n", f + 1, files[f], lag);
+
+        // 3. 位相回転で -lag サンプルずらして足し込む
+        // 回転子は漸化式で進め、誤差が溜まらないよう一定間隔で計算し直す
+        double w = -2.0 * M_PI * lag / M;
+        double complex step = cos(w) + I * sin(w);
+        double complex rot = 1.0;
+        for (int k = 0; k < num_bins; k++) {
+            if ((k & 4095) == 0) rot = cos(w * k) + I * sin(w * k);
+            for (int c = 0; c < channels; c++) acc[c][k] += spec[c][k] * rot;
+            rot *= step;
+        }
     }
 
-    // 時間領域で平均（最短長に揃える）
-    int response_len = min_response_len;
-    double *response_sum = (double *)calloc(response_len, sizeof(double));
-    for (int f = 0; f < num_response_files; f++) {
-        for (int i = 0; i < response_len; i++) {
-            response_sum[i] += (double)response_buffers[f][i] / 32768.0;
+    // 4. チャンネルごとに逆変換して平均
+    float **responses = NULL;
+    if (status == 0) {
+        responses = (float **)malloc(channels * sizeof(float *));
+        double scale = 1.0 / num_files;
+        for (int c = 0; c < channels; c++) {
+            acc[c][M / 2] = creal(acc[c][M / 2]); // Nyquist周波数の虚数部は0
+            fft_execute_c2r(plan, acc[c]);
+            const double *x = (const double *)acc[c];
+            responses[c] = (float *)malloc(len * sizeof(float));
+            for (int64_t i = 0; i < len; i++) responses[c][i] = (float)(x[i] * scale);
         }
     }
-    for (int i = 0; i < response_len; i++) {
-        response_sum[i] /= num_response_files;
+
+    for (int c = 0; c < channels; c++) {
+        free(spec[c]);
+        free(acc[c]);
     }
+    free(spec);
+    free(acc);
+    free_channels(take, channels);
+    free(ref);
+    free(corr);
+    fft_plan_destroy(plan);
+    if (!responses) return NULL;
+    *channels_out = channels;
+    *len_out = len;
+    return responses;
+}
+
+/**
+ * TSP を periods 周期連続して再生した収録から、1周期分の同期加算平均を求める
+ * 各ファイルの1周期目は過渡応答を含むため捨て、2周期目以降の完全な周期を
+ * 1回の逐次読み込みで周期長のバッファへ足し込む。メモリは1周期分で済む。
+ * 戻り値: チャンネルごとの平均（長さ period、呼び出し側で free_channels）、エラー時はNULL
+ */
+static float **average_periods(char **files, int num_files, int fs, int period, int periods,
+                               int *channels_out) {
+    double **acc = NULL; // 周期ごとの和（倍精度）
+    float **blocks = NULL;
+    int channels = 0;
+    int64_t used = 0; // 足し込んだ周期数（全ファイル合計）
+
+    for (int f = 0; f < num_files; f++) {
+        WavReader reader;
+        if (wav_reader_open(files[f], &reader) < 0) {
+            fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", files[f]);
+            free_sums(acc, channels);
+            free_channels(blocks, channels);
+            return NULL;
+        }
+        if (f == 0) {
+            channels = reader.channels;
+            acc = (double **)malloc(channels * sizeof(double *));
+            blocks = (float **)malloc(channels * sizeof(float *));
+            for (int c = 0; c < channels; c++) {
+                acc[c] = (double *)calloc(period, sizeof(double));
+                blocks[c] = (float *)malloc(AVERAGE_BLOCK * sizeof(float));
+            }
+        }
+        if (reader.fs != fs || reader.channels != channels) {
+            fprintf(stderr, "エラー: 応答ファイルのサンプリング周波数またはチャンネル数が一致しません (%s: %d Hz, %d ch)\n",
+                    files[f], reader.fs, reader.channels);
+            wav_reader_close(&reader);
+            free_sums(acc, channels);
+            free_channels(blocks, channels);
+            return NULL;
+        }
+
+        // 収録に含まれる完全な周期数（指定より少なければあるだけ使う）
+        int64_t avail = reader.num_frames / period;
+        if (avail > periods) avail = periods;
+        if (avail < 2) {
+            fprintf(stderr, "エラー: %s には2周期以上の収録が必要です（%lld サンプル、1周期 %d サンプル）\n",
+                    files[f], (long long)reader.num_frames, period);
+            wav_reader_close(&reader);
+            free_sums(acc, channels);
+            free_channels(blocks, channels);
+            return NULL;
+        }
 
-    int16_t *response_samples = (int16_t *)malloc(response_len * sizeof(int16_t));
-    for (int i = 0; i < response_len; i++) {
-        double s = response_sum[i] * 32768.0;
-        if (s > 32767.0) s = 32767.0;
-        if (s < -32768.0) s = -32768.0;
-        response_samples[i] = (int16_t)s;
+        // 1周期目を読み飛ばしたあと、周期内の位置 pos に合わせて足し込む
+        int64_t total = avail * period;
+        int pos = 0;
+        for (int64_t done = 0; done < total; ) {
+            int n = (total - done < AVERAGE_BLOCK) ? (int)(total - done) : AVERAGE_BLOCK;
+            if (wav_reader_read_planar(&reader, blocks, n) != n) {
+                fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", files[f]);
+                wav_reader_close(&reader);
+                free_sums(acc, channels);
+                free_channels(blocks, channels);
+                return NULL;
+            }
+            for (int i = 0; i < n; ) {
+                // 周期の境界までをひとまとめに処理する
+                int m = (n - i < period - pos) ? n - i : period - pos;
+                if (done + i >= period) {
+                    for (int c = 0; c < channels; c++) {
+                        double *dst = acc[c] + pos;
+                        const float *src = blocks[c] + i;
+                        for (int k = 0; k < m; k++) {
+                            dst[k] += src[k];
+                        }
+                    }
+                }
+                i += m;
+                pos += m;
+                if (pos == period) pos = 0;
+            }
+            done += n;
+        }
+        wav_reader_close(&reader);
+        used += avail - 1;
+        printf("TSP応答: %s から %lld 周期を同期加算\n", files[f], (long long)(avail - 1));
     }
 
-    printf("TSP応答: %d ファイルを平均、%d サンプル, fs = %d Hz\n", num_response_files, response_len, fs_response);
+    // 周期数で割ってから1回だけ単精度に丸める
+    float **responses = (float **)malloc(channels * sizeof(float *));
+    double scale = 1.0 / (double)used;
+    for (int c = 0; c < channels; c++) {
+        responses[c] = (float *)malloc(period * sizeof(float));
+        for (int i = 0; i < period; i++) {
+            responses[c][i] = (float)(acc[c][i] * scale);
+        }
+    }
+    free_sums(acc, channels);
+    free_channels(blocks, channels);
 
-    // 一時バッファ解放
-    for (int f = 0; f < num_response_files; f++) free(response_buffers[f]);
-    free(response_buffers);
-    free(response_lengths);
-    free(response_sum);
+    *channels_out = channels;
+    return responses;
+}
 
-    // 3. 信号長を統一（2のべき乗に拡張）
-    int N = 1;
-    int max_len = (tsp_len > response_len) ? tsp_len : response_len;
-    while (N < max_len) N <<= 1;
-    printf("FFT長: %d\n", N);
+/**
+ * 周期の和（全チャンネル）を読み込む（ドリフト推定用）
+ */
+static void read_period_mix(const WavMap *map, int64_t offset, int period, float **planes, double *mix) {
+    wav_map_read_planar(map, offset, planes, period);
+    for (int i = 0; i < period; i++) mix[i] = 0;
+    for (int c = 0; c < map->channels; c++) {
+        for (int i = 0; i < period; i++) mix[i] += planes[c][i];
+    }
+}
 
-    // 4. TSP信号をFFT
-    double complex *TSP = (double complex *)calloc(N, sizeof(double complex));
+/**
+ * 再生と録音の時計のずれ（ドリフト）を補正して同期加算（--periods K --drift）
+ * 1. 2周期目を基準に、各周期との巡回相互相関のピーク（放物線補間）から周期ごとの遅延を求める
+ * 2. 遅延を周期番号に対して直線で近似し、傾きからドリフト（1サンプルあたりのずれ）を得る
+ * 3. 各周期を近似直線上の位置から 1 + ドリフト 刻みで窓付きsinc補間して読み直し、足し込む
+ * 収録は mmap で開き、周期ごとに必要な範囲だけを読む。メモリは数周期分で済む。
+ * 補間で読む範囲がファイルの末尾を越える周期は使わない。
+ * 戻り値: チャンネルごとの平均（長さ period、呼び出し側で free_channels）、エラー時はNULL
+ */
+static float **average_periods_drift(char **files, int num_files, int fs, int period, int periods,
+                                     int *channels_out) {
+    fft_plan *plan = fft_plan_create_real(period);
+    resampler *rs = resampler_create(DRIFT_TAPS, DRIFT_PHASES);
+    if (!plan || !rs) {
+        fprintf(stderr, "エラー: FFTプランまたは補間フィルタの生成に失敗\n");
+        if (plan) fft_plan_destroy(plan);
+        resampler_destroy(rs);
+        return NULL;
+    }
+    int num_bins = period / 2 + 1;
+    double complex *ref = (double complex *)malloc(num_bins * sizeof(double complex));
+    double complex *spec = (double complex *)malloc(num_bins * sizeof(double complex));
+    double *lags = (double *)malloc(periods * sizeof(double));
+    float *out = (float *)malloc(period * sizeof(float));
+    double **acc = NULL; // 周期ごとの和（倍精度）
+    float **planes = NULL;
+    int channels = 0;
+    int64_t used = 0;
+    int status = 0;
+
+    for (int f = 0; f < num_files && status == 0; f++) {
+        WavMap map;
+        if (wav_map_open(files[f], &map) < 0) {
+            fprintf(stderr, "エラー: TSP応答 %s の読み込みに失敗\n", files[f]);
+            status = -1;
+            break;
+        }
+        if (f == 0) {
+            channels = map.channels;
+            acc = (double **)malloc(channels * sizeof(double *));
+            planes = (float **)malloc(channels * sizeof(float *));
+            for (int c = 0; c < channels; c++) {
+                acc[c] = (double *)calloc(period, sizeof(double));
+                // 補間には周期の前後に余白が要る（ドリフトで伸びる分も含めて1周期ぶん確保）
+                planes[c] = (float *)malloc((size_t)period * 2 * sizeof(float));
+            }
+        }
+        int64_t avail = map.num_samples / period;
+        if (avail > periods) avail = periods;
+        if (map.fs != fs || map.channels != channels || avail < 3) {
+            if (avail < 3) {
+                fprintf(stderr, "エラー: %s にはドリフト推定のため3周期以上の収録が必要です\n", files[f]);
+            } else {
+                fprintf(stderr, "エラー: 応答ファイルのサンプリング周波数またはチャンネル数が一致しません (%s: %d Hz, %d ch)\n",
+                        files[f], map.fs, map.channels);
+            }
+            wav_map_close(&map);
+            status = -1;
+            break;
+        }
+
+        // 1. 2周期目（p = 1）を基準に、p = 2〜avail-1 の遅延を求める
+        double *mix = (double *)spec;
+        read_period_mix(&map, period, period, planes, mix);
+        fft_execute_r2c(plan, spec);
+        for (int k = 0; k < num_bins; k++) ref[k] = conj(spec[k]);
+        lags[1] = 0;
+        for (int64_t p = 2; p < avail; p++) {
+            read_period_mix(&map, p * period, period, planes, mix);
+            fft_execute_r2c(plan, spec);
+            for (int k = 0; k < num_bins; k++) spec[k] *= ref[k];
+            fft_execute_c2r(plan, spec);
+            const double *r = (const double *)spec;
+            int best = 0;
+            for (int i = 1; i < period; i++) {
+                if (r[i] > r[best]) best = i;
+            }
+            double y0 = r[(best - 1 + period) % period], y1 = r[best], y2 = r[(best + 1) % period];
+            double denom = y0 - 2.0 * y1 + y2;
+            double frac = (denom < 0) ? 0.5 * (y0 - y2) / denom : 0;
+            // 巡回相関なので半周期を越える遅延は負のずれとみなす
+            lags[p] = ((best > period / 2) ? best - period : best) + frac;
+        }
+
+        // 2. 遅延を周期番号の一次式 a + b (p - 1) で近似（最小二乗）
+        int count = (int)avail - 1;
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (int64_t p = 1; p < avail; p++) {
+            double x = (double)(p - 1);
+            sx += x;
+            sy += lags[p];
+            sxx += x * x;
+            sxy += x * lags[p];
+        }
+        double b = (count * sxy - sx * sy) / (count * sxx - sx * sx);
+        double a = (sy - b * sx) / count;
+        double step = 1.0 + b / period;
+        printf("TSP応答: %s のドリフト %+.2f ppm（1周期あたり %+.3f サンプル）\n", files[f], b / period * 1e6, b);
+
+        // 3. 各周期を補正した位置から補間して足し込む
+        // ずれは収録の先頭（0周期目の始まり）から溜まるとみなし、周期 p の始まりを
+        // p * period + a + b * p とする（遅延を測った2周期目の始まりも b だけずれている）
+        int half = resampler_taps(rs) / 2;
+        int64_t added = 0;
+        for (int64_t p = 1; p < avail; p++) {
+            double start = p * (double)period + a + b * (double)p;
+            int64_t lo = (int64_t)floor(start) - half;
+            int64_t hi = (int64_t)ceil(start + period * step) + half;
+            if (lo < 0 || hi > map.num_samples || hi - lo > (int64_t)period * 2) continue;
+            wav_map_read_planar(&map, lo, planes, hi - lo);
+            for (int c = 0; c < channels; c++) {
+                resampler_process(rs, planes[c], hi - lo, start - lo, step, out, period);
+                double *dst = acc[c];
+                for (int i = 0; i < period; i++) dst[i] += out[i];
+            }
+            added++;
+        }
+        wav_map_close(&map);
+        used += added;
+        printf("TSP応答: %s から %lld 周期を同期加算\n", files[f], (long long)added);
+    }
+
+    if (status == 0 && used == 0) {
+        fprintf(stderr, "エラー: 同期加算できる周期がありません\n");
+        status = -1;
+    }
+    // 周期数で割ってから1回だけ単精度に丸める
+    float **responses = NULL;
+    if (status == 0) {
+        responses = (float **)malloc(channels * sizeof(float *));
+        double scale = 1.0 / (double)used;
+        for (int c = 0; c < channels; c++) {
+            responses[c] = (float *)malloc(period * sizeof(float));
+            for (int i = 0; i < period; i++) {
+                responses[c][i] = (float)(acc[c][i] * scale);
+            }
+        }
+    }
+    free_sums(acc, channels);
+    free_channels(planes, channels);
+    free(ref);
+    free(spec);
+    free(lags);
+    free(out);
+    resampler_destroy(rs);
+    fft_plan_destroy(plan);
+    if (status < 0) return NULL;
+    *channels_out = channels;
+    return responses;
+}
+
+/**
+ * TSP信号の実測スペクトルから正則化した逆フィルタを用意する（--inverse measured）
+ * 逆フィルタは conj(S) / (|S|^2 + λ(k)) で、tsp_gen のシフト量や帯域制限・
+ * 事前等化したTSPもそのまま扱える。<TSP信号>.reg.inv に同じTSP・FFT長・
+ * 正則化パラメータのキャッシュがあれば mmap で使い、無ければ計算して書き出す。
+ * plan: 共有する N 点の倍精度実数FFTプラン。単精度で計算する場合は NULL を渡し、
+ *       キャッシュが無いときだけここで一時的に作る。
+ * 戻り値: N/2+1 ビンの逆フィルタ。キャッシュを使った場合は cache の領域を指し
+ *         （*have_cache = 1）、計算した場合は *owned に確保した領域（呼び出し側で free）。
+ *         エラー時は NULL
+ */
+static const double complex *measured_inverse(const fft_plan *plan,
+                                              const char *tsp_file, const float *tsp_samples, int tsp_len,
+                                              int N, int fs, uint64_t hash,
+                                              double eps, double f_lo, double f_hi,
+                                              TspInverse *cache, int *have_cache, double complex **owned) {
+    uint64_t params = tsp_inverse_params(fs, eps, f_lo, f_hi);
+    char path[4096];
+    if (tsp_inverse_path(path, sizeof(path), tsp_file, ".reg.inv") < 0) return NULL;
+    if (tsp_inverse_open(path, cache) == 0) {
+        if (cache->hash == hash && cache->params == params && cache->n == N) {
+            *have_cache = 1;
+            printf("逆フィルタ: %s（実測スペクトル、キャッシュを使用）\n", path);
+            return cache->inverse;
+        }
+        tsp_inverse_close(cache);
+    }
+
+    // TSP信号をFFTし、そのスペクトルから逆フィルタを作る
+    int num_bins = N / 2 + 1;
+    fft_plan *own_plan = plan ? NULL : fft_plan_create_real(N);
+    if (!plan) plan = own_plan;
+    double complex *inverse = (double complex *)calloc(num_bins, sizeof(double complex));
+    unsigned char *mask = (unsigned char *)malloc(num_bins);
+    if (!plan || !inverse || !mask) {
+        fprintf(stderr, "エラー: メモリ確保に失敗\n");
+        if (own_plan) fft_plan_destroy(own_plan);
+        free(inverse);
+        free(mask);
+        return NULL;
+    }
+    double *tsp_time = (double *)inverse;
     for (int i = 0; i < tsp_len; i++) {
-        TSP[i] = (double)tsp_samples[i] / 32768.0;
+        tsp_time[i] = tsp_samples[i];
     }
-    simple_fft(TSP, N);
+    fft_execute_r2c(plan, inverse);
+    if (own_plan) fft_plan_destroy(own_plan);
+    tsp_inverse_regularized(inverse, inverse, N, fs, eps, f_lo, f_hi);
+    printf("逆フィルタ: 実測スペクトル（正則化 %g, 帯域 %.1f〜%.1f Hz）\n", eps, f_lo, f_hi);
 
-    // 5. TSP応答をFFT（2周期目を切り出す想定）
-    // 実際の測定では2周期再生して2周期目を切り出す必要がある
-    double complex *RESPONSE = (double complex *)calloc(N, sizeof(double complex));
-    int start_idx = (response_len >= tsp_len * 2) ? tsp_len : 0; // 2周期目があれば使用
-    int copy_len = (response_len - start_idx < N) ? response_len - start_idx : N;
-    for (int i = 0; i < copy_len; i++) {
-        RESPONSE[i] = (double)response_samples[start_idx + i] / 32768.0;
-    }
-    simple_fft(RESPONSE, N);
-
-    // 6. 逆フィルタを計算（down-TSP）
-    // down-TSP: exp(+j * 2πJ * (k/N)^2)
-    int J = tsp_len / 2; // TSP信号の実効長を推定
-    double complex *INV_FILTER = (double complex *)malloc(N * sizeof(double complex));
-    
-    for (int k = 0; k <= N / 2; k++) {
-        double theta = 2.0 * M_PI * J * pow((double)k / N, 2);
-        INV_FILTER[k] = cos(theta) + I * sin(theta);
-        
-        // 共役対称性
-        if (k > 0 && k < N / 2) {
-            INV_FILTER[N - k] = conj(INV_FILTER[k]);
-        }
-    }
-    INV_FILTER[N / 2] = creal(INV_FILTER[N / 2]) + 0 * I;
-
-    // 7. 周波数領域で除算（逆フィルタ適用）
-    double complex *IR_FREQ = (double complex *)malloc(N * sizeof(double complex));
-    for (int k = 0; k < N; k++) {
-        double tsp_mag = cabs(TSP[k]);
-        if (tsp_mag > 1e-10) {
-            // H(k) = Y(k) / S(k) = Y(k) * INV_FILTER(k)
-            IR_FREQ[k] = RESPONSE[k] * INV_FILTER[k];
+    // 正則化で除算は常に有限なので全ビンを有効とする
+    // キャッシュを書き出せなくても（読み取り専用の場所など）計算結果はそのまま使う
+    memset(mask, 1, num_bins);
+    if (tsp_inverse_write(path, N, 0, 0, hash, params, inverse, mask) == 0) {
+        printf("逆フィルタ: %s に保存しました。\n", path);
+    }
+    free(mask);
+    *owned = inverse;
+    return inverse;
+}
+
+/**
+ * 出力するIRの範囲を決める（--truncate, --length, --predelay）
+ * IRは長さ N の巡回信号として扱い、start から len サンプルを切り出す。
+ *   predelay_ms >= 0: 最も早いチャンネルのピークの predelay_ms 前を start とする。
+ *                     負の場合、auto_end か length を指定していれば TRIM_DEFAULT_PREDELAY_MS を使い
+ *                     （TSPの巡回シフトでピークは中ほどにあるため、先頭からでは無音ばかりになる）、
+ *                     どちらも無ければ0から
+ *   auto_end: 雑音レベルに達するまでの長さにする。雑音レベルは start から見て
+ *             0.8N〜0.9N の区間（ピークから最も遠く、減衰しきった部分）の平均パワーとし、
+ *             ピーク以降の TRIM_WINDOW_SEC ごとのパワーが雑音レベル + TRIM_MARGIN_DB を
+ *             下回った窓までを残す。チャンネルごとに求めた長さの最大を使う。
+ *   length > 0: 長さを明示（auto_end より優先）
+ */
+static void choose_ir_range(float *const *irs, int channels, int N, int fs,
+                            double predelay_ms, int auto_end, int length,
+                            int *start_out, int *len_out) {
+    // チャンネルごとのピーク位置
+    int *peaks = (int *)malloc(channels * sizeof(int));
+    for (int c = 0; c < channels; c++) {
+        int best = 0;
+        for (int i = 1; i < N; i++) {
+            if (fabsf(irs[c][i]) > fabsf(irs[c][best])) best = i;
+        }
+        peaks[c] = best;
+    }
+
+    // 1. 開始位置（巡回信号なので1チャンネル目のピークからの符号付きの差で最も早いものを探す）
+    int start = 0;
+    if (predelay_ms < 0 && (auto_end || length > 0)) predelay_ms = TRIM_DEFAULT_PREDELAY_MS;
+    if (predelay_ms >= 0) {
+        int earliest = 0;
+        for (int c = 1; c < channels; c++) {
+            int d = (int)((((int64_t)peaks[c] - peaks[0] + N + N / 2) % N) - N / 2);
+            if (d < earliest) earliest = d;
+        }
+        int margin = (int)lround(predelay_ms * fs / 1000.0);
+        start = (int)((((int64_t)peaks[0] + earliest - margin) % N + N) % N);
+    }
+
+    // 2. 長さ
+    int len = N;
+    if (length > 0) {
+        len = (length < N) ? length : N;
+    } else if (auto_end) {
+        int window = (int)(TRIM_WINDOW_SEC * fs);
+        if (window < 1) window = 1;
+        len = 0;
+        for (int c = 0; c < channels; c++) {
+            const float *ir = irs[c];
+            double noise = 0;
+            int noise_begin = (int)(N * 0.8), noise_end = (int)(N * 0.9);
+            for (int i = noise_begin; i < noise_end; i++) {
+                double v = ir[((int64_t)start + i) % N];
+                noise += v * v;
+            }
+            noise /= (noise_end > noise_begin) ? noise_end - noise_begin : 1;
+            double peak = irs[c][peaks[c]];
+            // 雑音のない信号でも止まるよう、ピークから -100 dB を下限とする
+            double threshold = noise * pow(10.0, TRIM_MARGIN_DB / 10.0);
+            if (threshold < peak * peak * 1e-10) threshold = peak * peak * 1e-10;
+
+            int pos = (int)(((int64_t)peaks[c] - start + N) % N); // start から見たピーク位置
+            int end = N;
+            for (int w = pos; w < N; w += window) {
+                int m = (N - w < window) ? N - w : window;
+                double energy = 0;
+                for (int i = 0; i < m; i++) {
+                    double v = ir[((int64_t)start + w + i) % N];
+                    energy += v * v;
+                }
+                if (energy / m <= threshold) {
+                    end = w + m;
+                    break;
+                }
+            }
+            if (end > len) len = end;
+        }
+    }
+    free(peaks);
+    *start_out = start;
+    *len_out = len;
+}
+
+/*
+ * IRの算出・出力の設定（コマンドラインで指定し、一括処理では全ジョブで共通）
+ */
+typedef struct {
+    int use_float;
+    int out_format;
+    int periods;
+    int drift;              // 周期ごとの遅延の傾きから時計のずれを補正する（--drift）
+    int combine;
+    double trim;            // トリム平均で上下それぞれ除くテイクの割合
+    int align;              // テイクの遅延を揃えてから平均する（--align）
+    int max_lag;            // 遅延の探索範囲（±サンプル）
+    int trim_auto;          // 雑音レベルに達したところで出力IRを切り詰める（--truncate）
+    int out_length;         // 出力IRの長さ（--length、0で切り詰めない）
+    double predelay_ms;     // ピークの何ms前から出力するか（--predelay、負で先頭から）
+    double fade_ms;         // 末尾の半Hann窓によるフェードアウト長 [ms]（--fade）
+} IrOptions;
+
+/**
+ * TSP応答を読み込み、時間領域で平均化（または合成）する
+ * 多チャンネルの収録（マイクアレイなど）はチャンネルごとに平均し、それぞれのIRを求める。
+ * --periods のときは1周期分（tsp_len サンプル）の同期加算を返す。
+ * 戻り値: チャンネルごとの応答（呼び出し側で free_channels）、エラー時はNULL
+ */
+static float **load_responses(char **files, int num_files, int fs, int64_t tsp_len, int num_threads,
+                              const IrOptions *opt, int *channels_out, int64_t *len_out) {
+    float **responses;
+    if (opt->periods > 1) {
+        // 周期信号の定常応答なので、1周期分の巡回たたみ込みとしてTSP長のFFTで逆畳み込みする
+        if (tsp_len > FFT_MAX_LEN || tsp_len % 2 != 0) {
+            fprintf(stderr, "エラー: 同期加算にはTSP信号長が偶数かつ %d サンプル以下である必要があります\n", FFT_MAX_LEN);
+            return NULL;
+        }
+        responses = opt->drift
+            ? average_periods_drift(files, num_files, fs, (int)tsp_len, opt->periods, channels_out)
+            : average_periods(files, num_files, fs, (int)tsp_len, opt->periods, channels_out);
+        *len_out = tsp_len;
+    } else if (opt->align) {
+        responses = align_takes(files, num_files, fs, opt->max_lag, channels_out, len_out);
+    } else if (opt->combine != COMBINE_MEAN) {
+        responses = combine_takes(files, num_files, fs, num_threads, opt->combine, opt->trim,
+                                  channels_out, len_out);
+    } else {
+        responses = average_takes(files, num_files, fs, num_threads, channels_out, len_out);
+    }
+    if (responses) {
+        printf("TSP応答: %d ファイルを%s、%lld サンプル, %d ch, fs = %d Hz\n",
+               num_files, (opt->combine == COMBINE_MEAN) ? "平均" : "合成", (long long)*len_out, *channels_out, fs);
+    }
+    return responses;
+}
+
+/**
+ * 信号長を統一するFFT長（高速に計算できる長さに拡張）
+ * 2の累乗に切り上げるとほぼ倍の長さになることがあるため、
+ * 2,3,5,7 だけで割り切れる偶数長（実数FFTの半分長が高速サイズ）を選ぶ。
+ * --periods のときはTSP信号の1周期の長さ。
+ * 戻り値: FFT長、長すぎる場合は0
+ */
+static int choose_fft_length(int64_t tsp_len, int64_t response_len, int periods) {
+    if (periods > 1) return (int)tsp_len;
+    int64_t max_len = (tsp_len > response_len) ? tsp_len : response_len;
+    if (max_len > FFT_MAX_LEN) {
+        fprintf(stderr, "エラー: 信号が長すぎます（FFT長の上限は %d サンプル）\n", FFT_MAX_LEN);
+        return 0;
+    }
+    return 2 * fft_next_fast_size((int)((max_len + 1) / 2));
+}
+
+/**
+ * IRの出力範囲を切り出し、WAVファイルに保存する
+ * モノラルは指定どおりのファイル名、多チャンネルは "_ch1" などを付けてチャンネルごとに保存。
+ * irs[c] は切り出した配列に置き換える（呼び出し側で free_channels）。
+ * 戻り値: 0、エラー時は-1
+ */
+static int save_irs(const char *output_file, float **irs, int channels, int N, int fs, const IrOptions *opt) {
+    // 出力範囲を決めて切り出す（巡回IRなので範囲は末尾から先頭へ回り込んでもよい）
+    int ir_start = 0, ir_len = N;
+    if (opt->trim_auto || opt->out_length > 0 || opt->predelay_ms >= 0 || opt->fade_ms > 0) {
+        choose_ir_range(irs, channels, N, fs, opt->predelay_ms, opt->trim_auto, opt->out_length,
+                        &ir_start, &ir_len);
+        int fade = (int)lround(opt->fade_ms * fs / 1000.0);
+        if (fade > ir_len) fade = ir_len;
+        for (int c = 0; c < channels; c++) {
+            float *out = (float *)malloc((size_t)ir_len * sizeof(float));
+            for (int i = 0; i < ir_len; i++) {
+                out[i] = irs[c][((int64_t)ir_start + i) % N];
+            }
+            // 半Hann窓: 1 から 0 へ余弦状に下げる
+            for (int i = 0; i < fade; i++) {
+                out[ir_len - fade + i] *= (float)(0.5 * (1.0 + cos(M_PI * (i + 1) / fade)));
+            }
+            free(irs[c]);
+            irs[c] = out;
+        }
+        printf("出力範囲: %d サンプル目から %d サンプル（フェードアウト %d サンプル）\n", ir_start, ir_len, fade);
+    }
+
+    for (int c = 0; c < channels; c++) {
+        char path[4096];
+        const char *ir_file = output_file;
+        if (channels > 1) {
+            if (wav_channel_path(path, sizeof(path), output_file, c) < 0) return -1;
+            ir_file = path;
+        }
+        if (write_wav_float(ir_file, irs[c], ir_len, fs, opt->out_format) < 0) {
+            fprintf(stderr, "エラー: WAVファイルの書き込みに失敗\n");
+            return -1;
+        }
+        printf("完了: %s を保存しました。\n", ir_file);
+    }
+    printf("インパルス応答長: %d サンプル (%.3f 秒)\n", ir_len, (double)ir_len / fs);
+    return 0;
+}
+
+/*
+ * 一括処理（--batch）
+ * TSP信号・FFTプラン・逆フィルタは全ジョブで共有し、読み取りのみ行う。
+ * ワーカーは次のジョブ番号を原子的に取り出して処理するため、テイク数や長さが
+ * ジョブごとに違っても空いたスレッドから順に仕事が回る。
+ */
+typedef struct {
+    const ManifestJob *jobs;
+    int num_jobs;
+    const IrOptions *opt;
+    const float *tsp_samples;
+    int64_t tsp_len;
+    int J;
+    int fs;
+    int N;
+    const double complex *inverse;
+    const fft_plan *plan;       // 倍精度のとき
+    const fft_planf *planf;     // 単精度のとき
+    atomic_int next_job;
+    int *status;                // ジョブごとの結果（0 または -1）
+} BatchContext;
+
+/**
+ * ジョブを1つずつ取り出して処理（parallel_for からワーカーごとに呼ばれる）
+ * 応答の読み込みはジョブの中では1スレッドで行い、並列化はジョブ単位にする。
+ */
+static void run_jobs(void *arg, int begin, int end) {
+    BatchContext *ctx = (BatchContext *)arg;
+    (void)begin;
+    (void)end;
+    for (;;) {
+        int j = atomic_fetch_add(&ctx->next_job, 1);
+        if (j >= ctx->num_jobs) break;
+        const ManifestJob *job = &ctx->jobs[j];
+        int channels = 0;
+        int64_t response_len = 0;
+        float **responses = load_responses(job->takes, job->num_takes, ctx->fs, ctx->tsp_len, 1, ctx->opt,
+                                           &channels, &response_len);
+        int status = responses ? 0 : -1;
+        float **irs = responses ? (float **)calloc(channels, sizeof(float *)) : NULL;
+        if (status == 0) {
+            status = ctx->opt->use_float
+                ? compute_ir_float(ctx->planf, ctx->tsp_samples, (int)ctx->tsp_len, ctx->J, ctx->inverse,
+                                   responses, channels, response_len, ctx->N, irs)
+                : compute_ir(ctx->plan, ctx->tsp_samples, (int)ctx->tsp_len, ctx->J, ctx->inverse,
+                             responses, channels, response_len, ctx->N, irs);
+        }
+        if (status == 0) status = save_irs(job->output, irs, channels, ctx->N, ctx->fs, ctx->opt);
+        if (status < 0) fprintf(stderr, "エラー: ジョブ %d（%s）に失敗しました\n", j + 1, job->output);
+        ctx->status[j] = status;
+        free_channels(responses, channels);
+        free_channels(irs, channels);
+    }
+}
+
+/**
+ * 出力 output を channels チャンネルで保存するときに実際に書き出すファイル名を作る
+ * モノラルはそのまま、多チャンネルは save_irs と同じく wav_channel_path で "_ch1" などを付ける。
+ * 戻り値: channels 個のファイル名（free_paths で解放）、エラー時はNULL
+ */
+static char **output_paths(const char *output, int channels) {
+    char **paths = (char **)calloc(channels, sizeof(char *));
+    for (int c = 0; c < channels; c++) {
+        char path[4096];
+        const char *name = output;
+        if (channels > 1) {
+            if (wav_channel_path(path, sizeof(path), output, c) < 0) {
+                for (int k = 0; k < c; k++) free(paths[k]);
+                free(paths);
+                return NULL;
+            }
+            name = path;
+        }
+        paths[c] = (char *)malloc(strlen(name) + 1);
+        strcpy(paths[c], name);
+    }
+    return paths;
+}
+
+static void free_paths(char **paths, int count) {
+    if (!paths) return;
+    for (int i = 0; i < count; i++) free(paths[i]);
+    free(paths);
+}
+
+/**
+ * 書き出すファイル名 out がTSP信号や応答ファイルと同じでないか確認（上書き事故防止）
+ * who: エラー表示で「出力ファイル名」の前に付ける説明（例: "ジョブ 3 の"）
+ * tsp_file は NULL、takes は0個でもよい。
+ * 戻り値: 0、被っていれば-1
+ */
+static int check_output_path(const char *who, const char *out, const char *tsp_file,
+                             char *const *takes, int num_takes) {
+    if (tsp_file && strcmp(out, tsp_file) == 0) {
+        fprintf(stderr, "エラー: %s出力ファイル名がTSP信号と同一です。実験データが上書きされます: %s\n", who, out);
+        return -1;
+    }
+    for (int t = 0; t < num_takes; t++) {
+        if (strcmp(out, takes[t]) == 0) {
+            fprintf(stderr, "エラー: %s出力ファイル名が応答ファイルと同一です。実験データが上書きされます: %s\n", who, out);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 出力 output（channels チャンネル）で書き出す全ファイル名を、TSP信号と応答ファイルに対して確認
+ * 戻り値: 0、被っていれば-1
+ */
+static int check_outputs(const char *output, int channels, const char *tsp_file,
+                         char *const *takes, int num_takes) {
+    char **paths = output_paths(output, channels);
+    int status = paths ? 0 : -1;
+    for (int c = 0; c < channels && status == 0; c++) {
+        status = check_output_path("", paths[c], tsp_file, takes, num_takes);
+    }
+    free_paths(paths, channels);
+    return status;
+}
+
+/**
+ * ジョブ一覧の出力先が入力ファイルや他のジョブと被っていないか確認（上書き事故防止）
+ * 多チャンネルのジョブは実際に書き出す "_ch1" などのファイル名に展開して比べる。
+ * job_channels[j]: ジョブ j の応答のチャンネル数
+ * 戻り値: 0、被っていれば-1
+ */
+static int check_batch_outputs(const ManifestJob *jobs, int num_jobs, const int *job_channels,
+                               const char *tsp_file) {
+    char ***paths = (char ***)calloc(num_jobs, sizeof(char **));
+    int status = 0;
+    for (int j = 0; j < num_jobs && status == 0; j++) {
+        paths[j] = output_paths(jobs[j].output, job_channels[j]);
+        if (!paths[j]) status = -1;
+    }
+
+    for (int j = 0; j < num_jobs && status == 0; j++) {
+        char who[32];
+        snprintf(who, sizeof(who), "ジョブ %d の", j + 1);
+        for (int c = 0; c < job_channels[j] && status == 0; c++) {
+            const char *out = paths[j][c];
+            status = check_output_path(who, out, tsp_file, NULL, 0);
+            for (int i = 0; i < num_jobs && status == 0; i++) {
+                status = check_output_path(who, out, NULL, jobs[i].takes, jobs[i].num_takes);
+            }
+            // 先のジョブ（と同じジョブの先のチャンネル）が書き出すファイル名との重複
+            for (int i = 0; i <= j && status == 0; i++) {
+                int count = (i < j) ? job_channels[i] : c;
+                for (int k = 0; k < count; k++) {
+                    if (strcmp(out, paths[i][k]) == 0) {
+                        fprintf(stderr, "エラー: ジョブ %d と %d の出力ファイル名が同一です: %s\n", i + 1, j + 1, out);
+                        status = -1;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int j = 0; j < num_jobs; j++) free_paths(paths[j], job_channels[j]);
+    free(paths);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    // オプションを取り除き、残りを位置引数として前に詰める
+    int num_threads = 1;
+    IrOptions opt = {
+        .use_float = 0,
+        .out_format = WAV_FORMAT_PCM16,
+        .periods = 1,
+        .drift = 0,
+        .combine = COMBINE_MEAN,
+        .trim = 0.2,
+        .align = 0,
+        .max_lag = 1024,
+        .trim_auto = 0,
+        .out_length = 0,
+        .predelay_ms = -1,
+        .fade_ms = 0,
+    };
+    int use_measured = 0;     // 逆フィルタを実測スペクトルから作る（--inverse measured）
+    double reg_eps = 1e-4;    // 帯域内の正則化量（最大パワー比）
+    double reg_f_lo = 0;      // 正則化の帯域 [Hz]（帯域外は強く正則化）
+    double reg_f_hi = -1;     // 既定は fs/2
+    const char *batch_file = NULL; // ジョブ一覧（--batch）
+    int nargs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            const char *prec = argv[++i];
+            if (strcmp(prec, "float") == 0) {
+                opt.use_float = 1;
+            } else if (strcmp(prec, "double") == 0) {
+                opt.use_float = 0;
+            } else {
+                fprintf(stderr, "エラー: --precision は float または double を指定してください: %s\n", prec);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--periods") == 0 && i + 1 < argc) {
+            opt.periods = atoi(argv[++i]);
+            if (opt.periods < 1) {
+                fprintf(stderr, "エラー: --periods は1以上を指定してください\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char *fmt = argv[++i];
+            if (strcmp(fmt, "pcm16") == 0) {
+                opt.out_format = WAV_FORMAT_PCM16;
+            } else if (strcmp(fmt, "float") == 0) {
+                opt.out_format = WAV_FORMAT_FLOAT32;
+            } else {
+                fprintf(stderr, "エラー: --format は pcm16 または float を指定してください: %s\n", fmt);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--combine") == 0 && i + 1 < argc) {
+            const char *name = argv[++i];
+            if (strcmp(name, "mean") == 0) {
+                opt.combine = COMBINE_MEAN;
+            } else if (strcmp(name, "trimmed") == 0) {
+                opt.combine = COMBINE_TRIMMED;
+            } else if (strcmp(name, "median") == 0) {
+                opt.combine = COMBINE_MEDIAN;
+            } else if (strcmp(name, "weighted") == 0) {
+                opt.combine = COMBINE_WEIGHTED;
+            } else {
+                fprintf(stderr, "エラー: --combine は mean, trimmed, median, weighted のいずれかを指定してください: %s\n", name);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--trim") == 0 && i + 1 < argc) {
+            opt.trim = atof(argv[++i]);
+            if (!(opt.trim >= 0 && opt.trim < 0.5)) {
+                fprintf(stderr, "エラー: --trim は0以上0.5未満を指定してください\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--truncate") == 0) {
+            opt.trim_auto = 1;
+        } else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc) {
+            opt.out_length = atoi(argv[++i]);
+            if (opt.out_length < 1) {
+                fprintf(stderr, "エラー: --length は1以上を指定してください\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--predelay") == 0 && i + 1 < argc) {
+            opt.predelay_ms = atof(argv[++i]);
+            if (!(opt.predelay_ms >= 0)) {
+                fprintf(stderr, "エラー: --predelay は0以上を指定してください [ms]\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--fade") == 0 && i + 1 < argc) {
+            opt.fade_ms = atof(argv[++i]);
+            if (!(opt.fade_ms >= 0)) {
+                fprintf(stderr, "エラー: --fade は0以上を指定してください [ms]\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--drift") == 0) {
+            opt.drift = 1;
+        } else if (strcmp(argv[i], "--align") == 0) {
+            opt.align = 1;
+        } else if (strcmp(argv[i], "--max-lag") == 0 && i + 1 < argc) {
+            opt.max_lag = atoi(argv[++i]);
+            if (opt.max_lag < 1) {
+                fprintf(stderr, "エラー: --max-lag は1以上を指定してください\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--inverse") == 0 && i + 1 < argc) {
+            const char *mode = argv[++i];
+            if (strcmp(mode, "measured") == 0) {
+                use_measured = 1;
+            } else if (strcmp(mode, "theory") == 0) {
+                use_measured = 0;
+            } else {
+                fprintf(stderr, "エラー: --inverse は theory または measured を指定してください: %s\n", mode);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--reg") == 0 && i + 1 < argc) {
+            reg_eps = atof(argv[++i]);
+            if (!(reg_eps > 0 && reg_eps < 1)) {
+                fprintf(stderr, "エラー: --reg は0より大きく1未満を指定してください\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--band") == 0 && i + 2 < argc) {
+            reg_f_lo = atof(argv[++i]);
+            reg_f_hi = atof(argv[++i]);
+            if (!(reg_f_lo >= 0 && reg_f_hi > reg_f_lo)) {
+                fprintf(stderr, "エラー: --band は 0 <= LO < HI [Hz] を指定してください\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_file = argv[++i];
         } else {
-            IR_FREQ[k] = 0.0;
+            argv[nargs++] = argv[i];
         }
     }
+    argc = nargs;
+
+    if (batch_file ? argc != 2 : argc < 4) {
+        fprintf(stderr, "使用方法: %s [--threads N] [--precision float|double] [--format pcm16|float] [--periods K [--drift]] [--combine mean|trimmed|median|weighted [--trim F]] [--align [--max-lag L]] [--truncate] [--length N] [--predelay MS] [--fade MS] [--inverse theory|measured [--reg EPS] [--band LO HI]] tsp_signal.wav response1.wav [response2.wav ...] impulse_response.wav\n", argv[0]);
+        fprintf(stderr, "          %s [同じオプション] --batch jobs.csv|jobs.json tsp_signal.wav\n", argv[0]);
+        fprintf(stderr, "応答ファイルは1つ以上指定してください。\n");
+        fprintf(stderr, "  --threads N  FFTと応答ファイルの読み込みに使うスレッド数（0で全コア、既定1）\n");
+        fprintf(stderr, "  --precision  FFT・スペクトル計算の精度（既定 double、float で高速・省メモリ）\n");
+        fprintf(stderr, "  --format     出力WAVの形式（既定 pcm16、float で32bit浮動小数点）\n");
+        fprintf(stderr, "  --periods K  応答は TSP を K 周期連続再生した収録（1周期目を捨てて同期加算）\n");
+        fprintf(stderr, "  --combine    複数テイクの合成（既定 mean、trimmed: トリム平均、median: 中央値、weighted: 残差の逆数で重み付け）\n");
+        fprintf(stderr, "  --trim F     trimmed で上下それぞれ除くテイクの割合（既定 0.2）\n");
+        fprintf(stderr, "  --drift      --periods で周期ごとの遅延の傾きから時計のずれを推定し、補間して補正\n");
+        fprintf(stderr, "  --align      相互相関でテイクの遅延（小数サンプル）を推定し、揃えてから平均\n");
+        fprintf(stderr, "  --max-lag L  --align の遅延の探索範囲（±サンプル、既定 1024）\n");
+        fprintf(stderr, "  --truncate   出力IRを雑音レベルに達したところで切り詰める\n");
+        fprintf(stderr, "  --length N   出力IRの長さ（サンプル、--truncate より優先）\n");
+        fprintf(stderr, "  --predelay MS ピークの MS ミリ秒前から出力する（直接音までの無音を除く、\n");
+        fprintf(stderr, "               --truncate か --length の場合の既定 %g ms）\n", TRIM_DEFAULT_PREDELAY_MS);
+        fprintf(stderr, "  --fade MS    出力IRの末尾 MS ミリ秒を半Hann窓でフェードアウト\n");
+        fprintf(stderr, "  --inverse    逆フィルタ（既定 theory: 理論上の down-TSP、measured: TSP信号の実測スペクトルを正則化）\n");
+        fprintf(stderr, "  --reg EPS    measured の帯域内の正則化量（最大パワー比、既定 1e-4）\n");
+        fprintf(stderr, "  --band LO HI measured で正則化を弱める帯域 [Hz]（既定 0〜fs/2、帯域外は強く抑える）\n");
+        fprintf(stderr, "  --batch FILE ジョブ一覧（CSV: 出力,テイク1,テイク2,... / JSON）の全ジョブを1プロセスで処理\n");
+        fprintf(stderr, "               TSP信号・FFTプラン・逆フィルタを共有し、--threads のスレッドでジョブを並列に処理\n");
+        return 1;
+    }
+    fft_set_threads(num_threads);
+    if (opt.periods > 1 && (opt.combine != COMBINE_MEAN || opt.align)) {
+        fprintf(stderr, "エラー: --combine と --align は複数ファイルのテイクの合成に使います（--periods とは併用できません）\n");
+        return 1;
+    }
+    if (opt.drift && opt.periods < 2) {
+        fprintf(stderr, "エラー: --drift は --periods（2以上）と一緒に指定してください\n");
+        return 1;
+    }
+    if (opt.align && opt.combine != COMBINE_MEAN) {
+        fprintf(stderr, "エラー: --align は平均（--combine mean）でのみ使えます\n");
+        return 1;
+    }
 
-    // 8. IFFTで時間領域に戻す
-    simple_ifft(IR_FREQ, N);
+    const char *tsp_file = argv[1];
+    const char *output_file = NULL;
+    int num_response_files = 0;
+    ManifestJob *jobs = NULL;
+    int num_jobs = 0;
+    if (batch_file) {
+        if (manifest_load(batch_file, &jobs, &num_jobs) < 0) return 1;
+    } else {
+        output_file = argv[argc - 1];
+        num_response_files = argc - 3;
 
-    // 9. 最大値で正規化してWAV出力
-    double max_amp = 0;
-    for (int i = 0; i < N; i++) {
-        double amp = fabs(creal(IR_FREQ[i]));
-        if (amp > max_amp) max_amp = amp;
+        /* 出力先が入力ファイルと被っていないか確認（上書き事故防止） */
+        /* 多チャンネルで実際に書き出す "_ch1" などは、チャンネル数が分かってから確認する */
+        if (check_outputs(output_file, 1, tsp_file, argv + 2, num_response_files) < 0) return 1;
     }
 
-    int16_t *ir_samples = (int16_t *)malloc(N * sizeof(int16_t));
-    for (int i = 0; i < N; i++) {
-        double sample = creal(IR_FREQ[i]) / max_amp * 0.9;
-        ir_samples[i] = (int16_t)(sample * 32767.0);
+    printf("TSP信号からインパルス応答を算出中...\n");
+    printf("TSP信号: %s\n", tsp_file);
+    if (batch_file) {
+        printf("ジョブ一覧: %s（%d ジョブ）\n", batch_file, num_jobs);
+    } else {
+        printf("TSP応答: %d ファイル", num_response_files);
+        for (int i = 0; i < num_response_files; i++) printf(" %s%s", argv[2 + i], (i < num_response_files - 1) ? "," : "");
+        printf("\n出力: %s\n", output_file);
     }
 
-    if (write_wav(output_file, ir_samples, N, fs_tsp) < 0) {
-        fprintf(stderr, "エラー: WAVファイルの書き込みに失敗\n");
+    // 1. TSP信号を読み込む（ファイルの形式によらず -1.0〜1.0 の実数にする）
+    WavMap tsp;
+    if (wav_map_open(tsp_file, &tsp) < 0) {
+        fprintf(stderr, "エラー: TSP信号の読み込みに失敗\n");
+        manifest_free(jobs, num_jobs);
+        return 1;
+    }
+    int64_t tsp_len = tsp.num_samples;
+    int fs_tsp = tsp.fs;
+    float *tsp_samples = (float *)malloc((size_t)tsp_len * sizeof(float));
+    if (!tsp_samples) {
+        fprintf(stderr, "エラー: メモリ確保に失敗\n");
+        wav_map_close(&tsp);
+        manifest_free(jobs, num_jobs);
+        return 1;
+    }
+    if (tsp.channels != 1) {
+        fprintf(stderr, "エラー: TSP信号はモノラルである必要があります（%d ch）\n", tsp.channels);
         free(tsp_samples);
-        free(response_samples);
-        free(TSP);
-        free(RESPONSE);
-        free(INV_FILTER);
-        free(IR_FREQ);
-        free(ir_samples);
+        wav_map_close(&tsp);
+        manifest_free(jobs, num_jobs);
+        return 1;
+    }
+    wav_map_read_float(&tsp, 0, tsp_samples, tsp_len);
+    printf("TSP信号: %lld サンプル, fs = %d Hz\n", (long long)tsp_len, fs_tsp);
+
+    // tsp_gen --periods で書いた複数周期のファイルなら、先頭の1周期をTSP信号とする
+    if (opt.periods > 1 && tsp_len % opt.periods == 0) {
+        int64_t period = tsp_len / opt.periods;
+        if (memcmp(tsp_samples, tsp_samples + period, (size_t)period * sizeof(float)) == 0) {
+            tsp_len = period;
+            printf("TSP信号: %d 周期のファイルとみなし、1周期 %lld サンプルを使用\n", opt.periods, (long long)tsp_len);
+        }
+    }
+
+    // tsp_gen が書き出した逆フィルタのサイドカー（<TSP信号>.inv）があれば読み込む
+    // 1周期分のデータのハッシュと長さが一致する場合のみ使い、実効長 J もサイドカーの値にする
+    uint64_t tsp_data_hash = tsp_hash(tsp.data, (size_t)tsp_len * tsp.bytes_per_sample);
+    int J = (int)(tsp_len / 2); // サイドカーが無い場合はTSP信号の実効長を推定
+    TspInverse sidecar;
+    int have_sidecar = 0;
+    char sidecar_path[4096];
+    if (!use_measured && tsp_inverse_path(sidecar_path, sizeof(sidecar_path), tsp_file, ".inv") == 0 &&
+        tsp_inverse_open(sidecar_path, &sidecar) == 0) {
+        if (sidecar.hash == tsp_data_hash && sidecar.params == 0 && sidecar.n == tsp_len) {
+            have_sidecar = 1;
+            J = sidecar.j;
+            printf("逆フィルタ: %s（J = %d, シフト量 = %d）\n", sidecar_path, sidecar.j, sidecar.shift);
+        } else {
+            fprintf(stderr, "警告: %s はTSP信号と一致しないため使用しません\n", sidecar_path);
+            tsp_inverse_close(&sidecar);
+        }
+    }
+    wav_map_close(&tsp);
+
+    // 2. TSP応答を読み込み、時間領域で平均化
+    // 一括処理ではここではヘッダだけを読み、全ジョブで共有するFFT長を最長のジョブに合わせる
+    int channels = 0;
+    int64_t response_len = 0;
+    float **responses = NULL;
+    int status = 0;
+    if (batch_file) {
+        // 出力ファイル名の確認には各ジョブのチャンネル数が要る
+        int *job_channels = (int *)calloc(num_jobs, sizeof(int));
+        for (int j = 0; j < num_jobs && status == 0; j++) {
+            int64_t job_len = 0;
+            status = check_takes(jobs[j].takes, jobs[j].num_takes, fs_tsp, &job_channels[j], &job_len);
+            if (job_len > response_len) response_len = job_len;
+        }
+        if (status == 0) status = check_batch_outputs(jobs, num_jobs, job_channels, tsp_file);
+        free(job_channels);
+        if (opt.periods > 1 && (tsp_len > FFT_MAX_LEN || tsp_len % 2 != 0)) {
+            fprintf(stderr, "エラー: 同期加算にはTSP信号長が偶数かつ %d サンプル以下である必要があります\n", FFT_MAX_LEN);
+            status = -1;
+        }
+    } else {
+        responses = load_responses(argv + 2, num_response_files, fs_tsp, tsp_len, fft_get_threads(), &opt,
+                                   &channels, &response_len);
+        if (!responses) status = -1;
+        if (status == 0 && channels > 1) {
+            status = check_outputs(output_file, channels, tsp_file, argv + 2, num_response_files);
+        }
+    }
+
+    // 3. 信号長を統一（高速に計算できるFFT長に拡張）
+    int N = 0;
+    if (status == 0) {
+        N = choose_fft_length(tsp_len, response_len, opt.periods);
+        if (N == 0) status = -1;
+    }
+    if (status < 0) {
+        if (have_sidecar) tsp_inverse_close(&sidecar);
+        free(tsp_samples);
+        free_channels(responses, channels);
+        manifest_free(jobs, num_jobs);
         return 1;
     }
+    printf("FFT長: %d（%s）\n", N, opt.use_float ? "単精度" : "倍精度");
+
+    // FFTプラン（TSP・応答・IRの変換で共有。一括処理では全ジョブで共有）
+    fft_plan *plan = opt.use_float ? NULL : fft_plan_create_real(N);
+    fft_planf *planf = opt.use_float ? fft_plan_create_realf(N) : NULL;
+    if (!plan && !planf) {
+        fprintf(stderr, "エラー: FFTプランの生成に失敗\n");
+        status = -1;
+    }
+
+    // サイドカーの逆フィルタはTSP信号の1周期と同じFFT長のときはそのまま使う
+    // 応答の方が長くFFT長を伸ばした場合は、サイドカーの J とマスクから N 点で計算し直す
+    // （どちらもTSP信号のFFTは不要）
+    const double complex *inverse = NULL;
+    double complex *owned_inverse = NULL;
+    if (status == 0 && have_sidecar && !use_measured) {
+        if (sidecar.n == N) {
+            inverse = sidecar.inverse;
+        } else {
+            owned_inverse = (double complex *)malloc((size_t)(N / 2 + 1) * sizeof(double complex));
+            if (owned_inverse) {
+                tsp_inverse_expand(owned_inverse, N, &sidecar);
+                printf("逆フィルタ: サイドカーの J = %d から %d 点で計算（TSP信号のFFTを省略）\n", sidecar.j, N);
+            }
+            inverse = owned_inverse;
+        }
+    }
+    if (status == 0 && use_measured) {
+        if (reg_f_hi < 0) reg_f_hi = fs_tsp / 2.0;
+        inverse = measured_inverse(plan, tsp_file, tsp_samples, (int)tsp_len, N, fs_tsp, tsp_data_hash,
+                                   reg_eps, reg_f_lo, reg_f_hi, &sidecar, &have_sidecar, &owned_inverse);
+        if (!inverse) status = -1;
+    }
+    if (status == 0 && batch_file && !inverse) {
+        // 一括処理では理論上の逆フィルタもここで1回だけ計算し、全ジョブで共有する
+        // （単精度でも位相の精度のため倍精度で計算する）
+        fft_plan *inverse_plan = plan ? plan : fft_plan_create_real(N);
+        if (inverse_plan) {
+            owned_inverse = build_inverse(inverse_plan, tsp_samples, (int)tsp_len, N, J);
+            if (inverse_plan != plan) fft_plan_destroy(inverse_plan);
+        }
+        inverse = owned_inverse;
+        if (!inverse) {
+            fprintf(stderr, "エラー: 逆フィルタの計算に失敗\n");
+            status = -1;
+        }
+    }
+
+    if (status == 0 && batch_file) {
+        // ジョブ単位で並列化するため、FFTと応答の読み込みは各ジョブの中では1スレッドにする
+        int workers = fft_get_threads();
+        if (workers > num_jobs) workers = num_jobs;
+        fft_set_threads(1);
+        int *job_status = (int *)calloc(num_jobs, sizeof(int));
+        BatchContext ctx = {
+            .jobs = jobs,
+            .num_jobs = num_jobs,
+            .opt = &opt,
+            .tsp_samples = tsp_samples,
+            .tsp_len = tsp_len,
+            .J = J,
+            .fs = fs_tsp,
+            .N = N,
+            .inverse = inverse,
+            .plan = plan,
+            .planf = planf,
+            .status = job_status,
+        };
+        atomic_init(&ctx.next_job, 0);
+        printf("一括処理: %d ジョブを %d スレッドで処理\n", num_jobs, workers);
+        parallel_for(workers, workers, run_jobs, &ctx);
 
-    printf("完了: %s を保存しました。\n", output_file);
-    printf("インパルス応答長: %d サンプル (%.3f 秒)\n", N, (double)N / fs_tsp);
+        int failed = 0;
+        for (int j = 0; j < num_jobs; j++) {
+            if (job_status[j] < 0) failed++;
+        }
+        printf("一括処理: %d / %d ジョブが完了\n", num_jobs - failed, num_jobs);
+        if (failed > 0) status = -1;
+        free(job_status);
+    } else if (status == 0) {
+        float **irs = (float **)calloc(channels, sizeof(float *));
+        status = opt.use_float
+            ? compute_ir_float(planf, tsp_samples, (int)tsp_len, J, inverse, responses, channels, response_len, N, irs)
+            : compute_ir(plan, tsp_samples, (int)tsp_len, J, inverse, responses, channels, response_len, N, irs);
+        if (status == 0) status = save_irs(output_file, irs, channels, N, fs_tsp, &opt);
+        free_channels(irs, channels);
+    }
 
     // メモリ解放
+    if (plan) fft_plan_destroy(plan);
+    if (planf) fft_plan_destroyf(planf);
+    if (have_sidecar) tsp_inverse_close(&sidecar);
+    free(owned_inverse);
     free(tsp_samples);
-    free(response_samples);
-    free(TSP);
-    free(RESPONSE);
-    free(INV_FILTER);
-    free(IR_FREQ);
-    free(ir_samples);
+    free_channels(responses, channels);
+    manifest_free(jobs, num_jobs);
 
-    return 0;
+    return (status == 0) ? 0 : 1;
 }
@@ -0,0 +1,805 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wav_io.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define WAV_HAVE_AVX2 1
+#endif
+
+// 対応するチャンネル数の上限
+#define WAV_MAX_CHANNELS 256
+
+// float へ変換する際の作業領域の長さ（サンプル数）
+#define WAV_CONVERT_BLOCK 4096
+
+/*
+ * チャンク走査の読み出し元（ファイルまたは mmap 領域）
+ */
+typedef struct {
+    FILE *fp;                   // ファイルから読む場合
+    const unsigned char *mem;   // メモリから読む場合（fp が NULL のとき）
+    size_t mem_size;
+    size_t pos;                 // 先頭からの位置
+} WavSource;
+
+/*
+ * 走査結果
+ */
+typedef struct {
+    int fs;                     // サンプリング周波数
+    int format;                 // サンプル形式（WAV_FORMAT_*）
+    int bytes_per_sample;       // 1サンプルのバイト数
+    int channels;               // チャンネル数
+    int64_t num_samples;        // 1チャンネルあたりのサンプル数（フレーム数）
+    size_t data_offset;         // data チャンク本体の位置
+} WavInfo;
+
+static int wav_source_read(WavSource *src, void *buf, size_t n) {
+    if (src->fp) {
+        if (fread(buf, 1, n, src->fp) != n) return -1;
+    } else {
+        if (src->mem_size - src->pos < n) return -1;
+        memcpy(buf, src->mem + src->pos, n);
+    }
+    src->pos += n;
+    return 0;
+}
+
+static int wav_source_skip(WavSource *src, size_t n) {
+    if (src->fp) {
+        // シークできないストリームは読み捨てる
+        if (fseek(src->fp, (long)n, SEEK_CUR) != 0) {
+            char tmp[4096];
+            size_t left = n;
+            while (left > 0) {
+                size_t k = (left < sizeof(tmp)) ? left : sizeof(tmp);
+                if (fread(tmp, 1, k, src->fp) != k) return -1;
+                left -= k;
+            }
+        }
+    } else {
+        if (src->mem_size - src->pos < n) return -1;
+    }
+    src->pos += n;
+    return 0;
+}
+
+static uint16_t wav_le16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t wav_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t wav_le64(const unsigned char *p) {
+    return (uint64_t)wav_le32(p) | ((uint64_t)wav_le32(p + 4) << 32);
+}
+
+/**
+ * fmt の形式タグ（1: PCM, 3: IEEE float）とビット数から WAV_FORMAT_* を得る
+ * 戻り値: 形式、未対応なら0
+ */
+static int wav_format_from_tag(unsigned tag, unsigned bits) {
+    if (tag == 1) {
+        if (bits == 16) return WAV_FORMAT_PCM16;
+        if (bits == 24) return WAV_FORMAT_PCM24;
+        if (bits == 32) return WAV_FORMAT_PCM32;
+    } else if (tag == 3) {
+        if (bits == 32) return WAV_FORMAT_FLOAT32;
+        if (bits == 64) return WAV_FORMAT_FLOAT64;
+    }
+    return 0;
+}
+
+/**
+ * ファイル上の形式のサンプル列を -1.0〜1.0 の float に変換
+ */
+static void wav_to_float(const unsigned char *src, int format, float *dst, size_t n) {
+    switch (format) {
+    case WAV_FORMAT_PCM16:
+        for (size_t i = 0; i < n; i++) {
+            int16_t v;
+            memcpy(&v, src + 2 * i, 2);
+            dst[i] = (float)v * (1.0f / 32768.0f);
+        }
+        break;
+    case WAV_FORMAT_PCM24:
+        for (size_t i = 0; i < n; i++) {
+            const unsigned char *p = src + 3 * i;
+            // 上位バイトに詰めてから算術シフトで符号拡張
+            int32_t v = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+            dst[i] = (float)v * (1.0f / 8388608.0f);
+        }
+        break;
+    case WAV_FORMAT_PCM32:
+        for (size_t i = 0; i < n; i++) {
+            int32_t v;
+            memcpy(&v, src + 4 * i, 4);
+            dst[i] = (float)((double)v * (1.0 / 2147483648.0));
+        }
+        break;
+    case WAV_FORMAT_FLOAT32:
+        memcpy(dst, src, n * sizeof(float));
+        break;
+    case WAV_FORMAT_FLOAT64:
+        for (size_t i = 0; i < n; i++) {
+            double v;
+            memcpy(&v, src + 8 * i, 8);
+            dst[i] = (float)v;
+        }
+        break;
+    }
+}
+
+/**
+ * インタリーブされた n フレームをチャンネルごとの配列に分ける（スカラー版）
+ */
+static void wav_deinterleave_scalar(const float *src, int channels, float *const *dst, size_t n) {
+    for (int c = 0; c < channels; c++) {
+        float *d = dst[c];
+        const float *p = src + c;
+        for (size_t i = 0; i < n; i++) {
+            d[i] = p[i * channels];
+        }
+    }
+}
+
+#ifdef WAV_HAVE_AVX2
+/**
+ * インタリーブの分離（AVX2版）
+ * 2ch と 8ch はシャッフル／8x8転置で、それ以外は gather で8フレームずつ処理する。
+ */
+__attribute__((target("avx2")))
+static void wav_deinterleave_avx2(const float *src, int channels, float *const *dst, size_t n) {
+    size_t i = 0;
+    if (channels == 2) {
+        float *l = dst[0], *r = dst[1];
+        for (; i + 8 <= n; i += 8) {
+            __m256 a = _mm256_loadu_ps(src + 2 * i);
+            __m256 b = _mm256_loadu_ps(src + 2 * i + 8);
+            // 128bit レーン内で偶数・奇数番目を集め、レーンをまたいで並べ直す
+            __m256 even = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m256 odd = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            even = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), _MM_SHUFFLE(3, 1, 2, 0)));
+            odd = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(odd), _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm256_storeu_ps(l + i, even);
+            _mm256_storeu_ps(r + i, odd);
+        }
+    } else if (channels == 8) {
+        for (; i + 8 <= n; i += 8) {
+            const float *p = src + 8 * i;
+            __m256 r0 = _mm256_loadu_ps(p);
+            __m256 r1 = _mm256_loadu_ps(p + 8);
+            __m256 r2 = _mm256_loadu_ps(p + 16);
+            __m256 r3 = _mm256_loadu_ps(p + 24);
+            __m256 r4 = _mm256_loadu_ps(p + 32);
+            __m256 r5 = _mm256_loadu_ps(p + 40);
+            __m256 r6 = _mm256_loadu_ps(p + 48);
+            __m256 r7 = _mm256_loadu_ps(p + 56);
+            __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+            __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+            __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+            __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+            __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+            __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+            __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+            __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+            __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+            _mm256_storeu_ps(dst[0] + i, _mm256_permute2f128_ps(u0, u4, 0x20));
+            _mm256_storeu_ps(dst[1] + i, _mm256_permute2f128_ps(u1, u5, 0x20));
+            _mm256_storeu_ps(dst[2] + i, _mm256_permute2f128_ps(u2, u6, 0x20));
+            _mm256_storeu_ps(dst[3] + i, _mm256_permute2f128_ps(u3, u7, 0x20));
+            _mm256_storeu_ps(dst[4] + i, _mm256_permute2f128_ps(u0, u4, 0x31));
+            _mm256_storeu_ps(dst[5] + i, _mm256_permute2f128_ps(u1, u5, 0x31));
+            _mm256_storeu_ps(dst[6] + i, _mm256_permute2f128_ps(u2, u6, 0x31));
+            _mm256_storeu_ps(dst[7] + i, _mm256_permute2f128_ps(u3, u7, 0x31));
+        }
+    } else {
+        __m256i idx = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                         _mm256_set1_epi32(channels));
+        for (; i + 8 <= n; i += 8) {
+            const float *p = src + i * channels;
+            for (int c = 0; c < channels; c++) {
+                _mm256_storeu_ps(dst[c] + i, _mm256_i32gather_ps(p + c, idx, 4));
+            }
+        }
+    }
+
+    // 8フレームに満たない残り
+    for (int c = 0; c < channels; c++) {
+        for (size_t k = i; k < n; k++) {
+            dst[c][k] = src[k * channels + c];
+        }
+    }
+}
+#endif
+
+static void wav_deinterleave(const float *src, int channels, float *const *dst, size_t n) {
+#ifdef WAV_HAVE_AVX2
+    // 複数のスレッドから呼ばれるため、判定結果は原子的に読み書きする
+    static atomic_int use_avx2 = -1;
+    int avx2 = atomic_load(&use_avx2);
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+        atomic_store(&use_avx2, avx2);
+    }
+    if (avx2) {
+        wav_deinterleave_avx2(src, channels, dst, n);
+        return;
+    }
+#endif
+    wav_deinterleave_scalar(src, channels, dst, n);
+}
+
+/**
+ * ファイル上の形式のインタリーブされた frames フレームを、チャンネルごとの float 配列に変換
+ * WAV_CONVERT_BLOCK サンプルずつ float に直してから分離する。
+ */
+static void wav_to_planar(const unsigned char *src, int format, int bytes_per_sample, int channels,
+                          float *const *dst, size_t frames) {
+    if (channels == 1) {
+        wav_to_float(src, format, dst[0], frames);
+        return;
+    }
+
+    float tmp[WAV_CONVERT_BLOCK];
+    float *out[WAV_MAX_CHANNELS];
+    size_t block = WAV_CONVERT_BLOCK / channels; // WAV_MAX_CHANNELS 以下なので1以上
+    for (size_t done = 0; done < frames; done += block) {
+        size_t n = (frames - done < block) ? frames - done : block;
+        wav_to_float(src, format, tmp, n * channels);
+        for (int c = 0; c < channels; c++) out[c] = dst[c] + done;
+        wav_deinterleave(tmp, channels, out, n);
+        src += n * channels * bytes_per_sample;
+    }
+}
+
+/**
+ * RIFF チャンクを順に走査して fmt と data を探す
+ * LIST, fact, bext, JUNK など未知のチャンクは読み飛ばす（奇数長は1バイトの詰め物付き）。
+ * RF64/BW64 では ds64 チャンクの64bit長を使う（32bit のサイズ欄は 0xFFFFFFFF）。
+ * 戻ったとき src は data チャンク本体の先頭を指す。
+ */
+static int wav_scan(WavSource *src, WavInfo *info) {
+    unsigned char riff[12];
+    if (wav_source_read(src, riff, sizeof(riff)) < 0) {
+        fprintf(stderr, "エラー: WAVヘッダの読み込みに失敗\n");
+        return -1;
+    }
+    int is_rf64 = (memcmp(riff, "RF64", 4) == 0 || memcmp(riff, "BW64", 4) == 0);
+    if ((memcmp(riff, "RIFF", 4) != 0 && !is_rf64) || memcmp(riff + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "エラー: 無効なWAVファイル\n");
+        return -1;
+    }
+
+    int have_fmt = 0;
+    int have_ds64 = 0;
+    uint64_t ds64_data_size = 0;
+    for (;;) {
+        unsigned char chunk[8];
+        if (wav_source_read(src, chunk, sizeof(chunk)) < 0) {
+            fprintf(stderr, "エラー: 無効なWAVファイル（data チャンクがありません）\n");
+            return -1;
+        }
+        uint64_t size = wav_le32(chunk + 4);
+
+        if (is_rf64 && memcmp(chunk, "ds64", 4) == 0) {
+            unsigned char ds64[24]; // RIFFサイズ, dataサイズ, サンプル数（各64bit）
+            if (size < sizeof(ds64) || wav_source_read(src, ds64, sizeof(ds64)) < 0) {
+                fprintf(stderr, "エラー: 無効なWAVファイル（ds64 チャンクが不正）\n");
+                return -1;
+            }
+            ds64_data_size = wav_le64(ds64 + 8);
+            have_ds64 = 1;
+            if (wav_source_skip(src, (size - sizeof(ds64)) + (size & 1)) < 0) {
+                fprintf(stderr, "エラー: WAVヘッダの読み込みに失敗\n");
+                return -1;
+            }
+        } else if (memcmp(chunk, "fmt ", 4) == 0) {
+            // WAVE_FORMAT_EXTENSIBLE の拡張部（サブフォーマットGUID）まで含めて最大40バイト
+            unsigned char fmt[40];
+            size_t fmt_len = (size < sizeof(fmt)) ? (size_t)size : sizeof(fmt);
+            if (size < 16 || wav_source_read(src, fmt, fmt_len) < 0) {
+                fprintf(stderr, "エラー: 無効なWAVファイル（fmt チャンクが不正）\n");
+                return -1;
+            }
+            uint16_t audio_format = wav_le16(fmt);
+            uint16_t num_channels = wav_le16(fmt + 2);
+            uint16_t bits_per_sample = wav_le16(fmt + 14);
+            if (audio_format == 0xFFFE && fmt_len >= 26) {
+                audio_format = wav_le16(fmt + 24); // サブフォーマットGUIDの先頭2バイト
+            }
+            info->format = wav_format_from_tag(audio_format, bits_per_sample);
+            if (info->format == 0 || num_channels == 0 || num_channels > WAV_MAX_CHANNELS) {
+                fprintf(stderr, "エラー: 未対応のWAV形式です（形式 %u, %u bit, %u ch）\n",
+                        audio_format, bits_per_sample, num_channels);
+                return -1;
+            }
+            info->bytes_per_sample = bits_per_sample / 8;
+            info->channels = num_channels;
+            info->fs = (int)wav_le32(fmt + 4);
+            have_fmt = 1;
+            if (wav_source_skip(src, (size - fmt_len) + (size & 1)) < 0) {
+                fprintf(stderr, "エラー: WAVヘッダの読み込みに失敗\n");
+                return -1;
+            }
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_fmt) {
+                fprintf(stderr, "エラー: 無効なWAVファイル（data より前に fmt チャンクがありません）\n");
+                return -1;
+            }
+            if (have_ds64 && size == 0xFFFFFFFFu) size = ds64_data_size;
+            // 録音中断などで data の長さがファイルを超える場合は実在する分だけ使う
+            if (!src->fp && size > src->mem_size - src->pos) {
+                size = src->mem_size - src->pos;
+            }
+            info->num_samples = (int64_t)(size / ((uint64_t)info->bytes_per_sample * info->channels));
+            info->data_offset = src->pos;
+            return 0;
+        } else {
+            if (wav_source_skip(src, (size_t)size + (size & 1)) < 0) {
+                fprintf(stderr, "エラー: 無効なWAVファイル（チャンクが途中で切れています）\n");
+                return -1;
+            }
+        }
+    }
+}
+
+/**
+ * mmap できない場合の読み込み（ヒープへコピー）
+ */
+static int wav_read_fallback(const char *filename, WavMap *wav) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "エラー: %s を開けません\n", filename);
+        return -1;
+    }
+
+    WavSource src = { fp, NULL, 0, 0 };
+    WavInfo info;
+    if (wav_scan(&src, &info) < 0) {
+        fclose(fp);
+        return -1;
+    }
+    wav->fs = info.fs;
+    wav->format = info.format;
+    wav->bytes_per_sample = info.bytes_per_sample;
+    wav->channels = info.channels;
+    wav->num_samples = info.num_samples;
+
+    size_t bytes = (size_t)info.num_samples * info.channels * info.bytes_per_sample;
+    void *data = malloc(bytes);
+    if (!data) {
+        fprintf(stderr, "エラー: メモリ確保に失敗\n");
+        fclose(fp);
+        return -1;
+    }
+    if (fread(data, 1, bytes, fp) != bytes) {
+        fprintf(stderr, "エラー: データの読み込みに失敗\n");
+        free(data);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+    wav->data = data;
+    return 0;
+}
+
+int wav_map_open(const char *filename, WavMap *wav) {
+    memset(wav, 0, sizeof(WavMap));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "エラー: %s を開けません\n", filename);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return wav_read_fallback(filename, wav);
+    }
+    if (st.st_size == 0) {
+        fprintf(stderr, "エラー: WAVヘッダの読み込みに失敗\n");
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // マッピングはファイルを閉じても残る
+    if (map == MAP_FAILED) {
+        return wav_read_fallback(filename, wav);
+    }
+
+    // 先頭から順に一度だけ読むため、先読みを強めて読み終えたページは早めに手放す
+    // （ファイル全体の WILLNEED はメモリより長い収録を丸ごと読み込んでしまうため、
+    //   読み込む範囲ごとに wav_map_prefetch で指定する）
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    WavSource src = { NULL, (const unsigned char *)map, size, 0 };
+    WavInfo info;
+    if (wav_scan(&src, &info) < 0) {
+        munmap(map, size);
+        return -1;
+    }
+
+    wav->map = map;
+    wav->map_size = size;
+    wav->fs = info.fs;
+    wav->format = info.format;
+    wav->bytes_per_sample = info.bytes_per_sample;
+    wav->channels = info.channels;
+    wav->num_samples = info.num_samples;
+    wav->data = (const char *)map + info.data_offset;
+    return 0;
+}
+
+/**
+ * これから読む範囲 [src, src + bytes) のページの先読みを指示する
+ * 周期ごと・テイクごとに離れた位置を読む場合も、必要な範囲だけを読み込ませる。
+ */
+static void wav_map_prefetch(const WavMap *wav, const unsigned char *src, size_t bytes) {
+    if (!wav->map || bytes == 0) return;
+    long page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)src & ~(uintptr_t)(page_size - 1);
+    uintptr_t end = (uintptr_t)src + bytes;
+    madvise((void *)begin, end - begin, MADV_WILLNEED);
+}
+
+void wav_map_read_float(const WavMap *wav, int64_t offset, float *dst, int64_t count) {
+    size_t frame_bytes = (size_t)wav->channels * wav->bytes_per_sample;
+    const unsigned char *src = (const unsigned char *)wav->data + (size_t)offset * frame_bytes;
+    wav_map_prefetch(wav, src, (size_t)count * frame_bytes);
+    wav_to_float(src, wav->format, dst, (size_t)count * wav->channels);
+}
+
+void wav_map_read_planar(const WavMap *wav, int64_t offset, float *const *dst, int64_t count) {
+    size_t frame_bytes = (size_t)wav->channels * wav->bytes_per_sample;
+    const unsigned char *src = (const unsigned char *)wav->data + (size_t)offset * frame_bytes;
+    wav_map_prefetch(wav, src, (size_t)count * frame_bytes);
+    wav_to_planar(src, wav->format, wav->bytes_per_sample, wav->channels, dst, (size_t)count);
+}
+
+void wav_map_close(WavMap *wav) {
+    if (wav->map) {
+        munmap(wav->map, wav->map_size);
+    } else {
+        free((void *)wav->data);
+    }
+    memset(wav, 0, sizeof(WavMap));
+}
+
+// 逐次読み書きで使う stdio バッファの大きさ
+#define WAV_STREAM_BUFFER (1 << 16)
+
+// 書き出すヘッダの最大長（RIFF + ds64 + fmt + fact + data）
+#define WAV_MAX_HEADER 96
+
+int wav_reader_open(const char *filename, WavReader *reader) {
+    memset(reader, 0, sizeof(WavReader));
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "エラー: %s を開けません\n", filename);
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, WAV_STREAM_BUFFER);
+
+    WavSource src = { fp, NULL, 0, 0 };
+    WavInfo info;
+    if (wav_scan(&src, &info) < 0) {
+        fclose(fp);
+        return -1;
+    }
+    reader->fs = info.fs;
+    reader->format = info.format;
+    reader->bytes_per_sample = info.bytes_per_sample;
+    reader->channels = info.channels;
+    reader->num_frames = info.num_samples;
+
+    reader->fp = fp;
+    reader->frames_left = reader->num_frames;
+    return 0;
+}
+
+/**
+ * 最大 max_frames フレームをファイル上の形式のまま reader->raw に読み込む
+ * 戻り値: 読み込んだフレーム数、エラー時は-1
+ */
+static int wav_reader_fill(WavReader *reader, int max_frames) {
+    int n = (max_frames < reader->frames_left) ? max_frames : (int)reader->frames_left;
+    if (n <= 0) return 0;
+
+    size_t bytes = (size_t)n * reader->channels * reader->bytes_per_sample;
+    if (bytes > reader->raw_size) {
+        unsigned char *raw = (unsigned char *)realloc(reader->raw, bytes);
+        if (!raw) {
+            fprintf(stderr, "エラー: メモリ確保に失敗\n");
+            return -1;
+        }
+        reader->raw = raw;
+        reader->raw_size = bytes;
+    }
+    if (fread(reader->raw, 1, bytes, reader->fp) != bytes) {
+        fprintf(stderr, "エラー: データの読み込みに失敗\n");
+        return -1;
+    }
+    reader->frames_left -= n;
+    return n;
+}
+
+int wav_reader_read_float(WavReader *reader, float *buf, int max_frames) {
+    int n = wav_reader_fill(reader, max_frames);
+    if (n > 0) wav_to_float(reader->raw, reader->format, buf, (size_t)n * reader->channels);
+    return n;
+}
+
+int wav_reader_read_planar(WavReader *reader, float *const *planes, int max_frames) {
+    int n = wav_reader_fill(reader, max_frames);
+    if (n > 0) {
+        wav_to_planar(reader->raw, reader->format, reader->bytes_per_sample, reader->channels, planes, n);
+    }
+    return n;
+}
+
+void wav_reader_close(WavReader *reader) {
+    if (reader->fp) fclose(reader->fp);
+    free(reader->raw);
+    memset(reader, 0, sizeof(WavReader));
+}
+
+static void wav_put16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static void wav_put32(unsigned char *p, uint32_t v) {
+    wav_put16(p, (uint16_t)v);
+    wav_put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void wav_put64(unsigned char *p, uint64_t v) {
+    wav_put32(p, (uint32_t)v);
+    wav_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+// ds64 チャンク本体の長さ（RIFFサイズ, dataサイズ, サンプル数, 表の要素数）
+#define WAV_DS64_SIZE 28
+
+// 32bit のサイズ欄に収まる最大値
+#define WAV_MAX_RIFF_SIZE 0xFFFFFFFFull
+
+static int wav_format_bytes(int format) {
+    return (format == WAV_FORMAT_FLOAT32) ? 4 : 2;
+}
+
+/**
+ * ヘッダのバイト数
+ * PCM16 は fmt 16バイト、FLOAT32 は cbSize 付きの fmt 18バイトと fact チャンクを持つ。
+ */
+static size_t wav_header_size(int format, int reserve_ds64) {
+    size_t fmt_size = (format == WAV_FORMAT_FLOAT32) ? 18 + 12 : 16;
+    return 12 + (reserve_ds64 ? 8 + WAV_DS64_SIZE : 0) + 8 + fmt_size + 8;
+}
+
+/**
+ * num_frames 書いたときに ds64 なしで RIFF サイズ欄に収まるか
+ */
+static int wav_fits_riff(int format, int64_t num_frames) {
+    return wav_header_size(format, 0) - 8 + (uint64_t)num_frames * wav_format_bytes(format) <= WAV_MAX_RIFF_SIZE;
+}
+
+/**
+ * モノラルのヘッダを組み立てる（format は WAV_FORMAT_PCM16 または WAV_FORMAT_FLOAT32）
+ * reserve_ds64 なら fmt の前に ds64 と同じ大きさの領域を置く。4GB を超えたときは
+ * その領域を ds64 に書き換えて RF64 とし、収まったときは JUNK のまま残す。
+ * 戻り値: ヘッダのバイト数
+ */
+static size_t wav_build_header(unsigned char *buf, int fs, int format, int64_t num_frames, int reserve_ds64) {
+    int is_float = (format == WAV_FORMAT_FLOAT32);
+    int bytes = wav_format_bytes(format);
+    size_t header_size = wav_header_size(format, reserve_ds64);
+    uint64_t data_size = (uint64_t)num_frames * bytes;
+    uint64_t riff_size = header_size - 8 + data_size;
+    int rf64 = reserve_ds64 && riff_size > WAV_MAX_RIFF_SIZE;
+    unsigned char *p = buf;
+
+    memcpy(p, rf64 ? "RF64" : "RIFF", 4);
+    wav_put32(p + 4, rf64 ? 0xFFFFFFFFu : (uint32_t)riff_size);
+    memcpy(p + 8, "WAVE", 4);
+    p += 12;
+
+    if (reserve_ds64) {
+        memset(p, 0, 8 + WAV_DS64_SIZE);
+        memcpy(p, rf64 ? "ds64" : "JUNK", 4);
+        wav_put32(p + 4, WAV_DS64_SIZE);
+        if (rf64) {
+            wav_put64(p + 8, riff_size);
+            wav_put64(p + 16, data_size);
+            wav_put64(p + 24, (uint64_t)num_frames);
+        }
+        p += 8 + WAV_DS64_SIZE;
+    }
+
+    memcpy(p, "fmt ", 4);
+    wav_put32(p + 4, is_float ? 18 : 16);
+    wav_put16(p + 8, is_float ? 3 : 1);  // IEEE float / PCM
+    wav_put16(p + 10, 1);                // モノラル
+    wav_put32(p + 12, (uint32_t)fs);
+    wav_put32(p + 16, (uint32_t)fs * bytes);
+    wav_put16(p + 20, (uint16_t)bytes);
+    wav_put16(p + 22, (uint16_t)(bytes * 8));
+    p += 24;
+    if (is_float) {
+        wav_put16(p, 0);                 // cbSize
+        p += 2;
+        // PCM 以外では fact チャンクにサンプル数を書く
+        memcpy(p, "fact", 4);
+        wav_put32(p + 4, 4);
+        wav_put32(p + 8, rf64 ? 0xFFFFFFFFu : (uint32_t)num_frames);
+        p += 12;
+    }
+
+    memcpy(p, "data", 4);
+    wav_put32(p + 4, rf64 ? 0xFFFFFFFFu : (uint32_t)data_size);
+    p += 8;
+
+    return (size_t)(p - buf);
+}
+
+int wav_writer_open_sized(const char *filename, WavWriter *writer, int fs, int format,
+                                 int64_t expected_frames) {
+    memset(writer, 0, sizeof(WavWriter));
+    if (format != WAV_FORMAT_PCM16 && format != WAV_FORMAT_FLOAT32) {
+        fprintf(stderr, "エラー: 書き込みは 16bit PCM と 32bit float のみ対応です\n");
+        return -1;
+    }
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        fprintf(stderr, "エラー: %s を開けません\n", filename);
+        return -1;
+    }
+    setvbuf(fp, NULL, _IOFBF, WAV_STREAM_BUFFER);
+
+    writer->fs = fs;
+    writer->format = format;
+    writer->reserve_ds64 = (expected_frames < 0 || !wav_fits_riff(format, expected_frames));
+
+    // データ長は未確定なので0で仮置きする
+    unsigned char head[WAV_MAX_HEADER];
+    size_t head_size = wav_build_header(head, fs, format, 0, writer->reserve_ds64);
+    if (fwrite(head, 1, head_size, fp) != head_size) {
+        fprintf(stderr, "エラー: %s への書き込みに失敗\n", filename);
+        fclose(fp);
+        return -1;
+    }
+
+    writer->fp = fp;
+    return 0;
+}
+
+int wav_writer_open(const char *filename, WavWriter *writer, int fs, int format) {
+    return wav_writer_open_sized(filename, writer, fs, format, -1);
+}
+
+int wav_writer_write(WavWriter *writer, const int16_t *buf, int num_frames) {
+    if (writer->format != WAV_FORMAT_PCM16) {
+        fprintf(stderr, "エラー: 16bit PCM 以外の出力に整数サンプルは書けません\n");
+        return -1;
+    }
+    if (num_frames <= 0) return 0;
+    if (fwrite(buf, sizeof(int16_t), num_frames, writer->fp) != (size_t)num_frames) {
+        fprintf(stderr, "エラー: WAVデータの書き込みに失敗\n");
+        return -1;
+    }
+    writer->num_frames += num_frames;
+    return 0;
+}
+
+int wav_writer_write_float(WavWriter *writer, const float *buf, int num_frames) {
+    if (num_frames <= 0) return 0;
+    if (writer->format == WAV_FORMAT_FLOAT32) {
+        if (fwrite(buf, sizeof(float), num_frames, writer->fp) != (size_t)num_frames) {
+            fprintf(stderr, "エラー: WAVデータの書き込みに失敗\n");
+            return -1;
+        }
+        writer->num_frames += num_frames;
+        return 0;
+    }
+
+    // 16bit へは四捨五入し、範囲外はクリップする
+    int16_t tmp[WAV_CONVERT_BLOCK];
+    for (int done = 0; done < num_frames; ) {
+        int n = (num_frames - done < WAV_CONVERT_BLOCK) ? num_frames - done : WAV_CONVERT_BLOCK;
+        for (int i = 0; i < n; i++) {
+            float v = buf[done + i] * 32768.0f;
+            if (v > 32767.0f) v = 32767.0f;
+            if (v < -32768.0f) v = -32768.0f;
+            tmp[i] = (int16_t)lrintf(v);
+        }
+        if (wav_writer_write(writer, tmp, n) < 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+int wav_writer_close(WavWriter *writer) {
+    if (!writer->fp) return -1;
+    int ret = 0;
+
+    unsigned char head[WAV_MAX_HEADER];
+    size_t head_size = wav_build_header(head, writer->fs, writer->format, writer->num_frames,
+                                        writer->reserve_ds64);
+    if (!writer->reserve_ds64 && !wav_fits_riff(writer->format, writer->num_frames)) {
+        fprintf(stderr, "エラー: データが4GBを超えたためWAVヘッダを書けません\n");
+        ret = -1;
+    } else if (fseek(writer->fp, 0, SEEK_SET) != 0 ||
+               fwrite(head, 1, head_size, writer->fp) != head_size) {
+        fprintf(stderr, "エラー: WAVヘッダの書き込みに失敗\n");
+        ret = -1;
+    }
+    if (fclose(writer->fp) != 0) ret = -1;
+    memset(writer, 0, sizeof(WavWriter));
+    return ret;
+}
+
+int write_wav(const char *filename, const int16_t *samples, int64_t num_samples, int fs) {
+    WavWriter writer;
+    if (wav_writer_open_sized(filename, &writer, fs, WAV_FORMAT_PCM16, num_samples) < 0) return -1;
+    // fwrite の1回あたりの長さを int に収めるため分けて書く
+    for (int64_t done = 0; done < num_samples; ) {
+        int n = (num_samples - done < (1 << 30)) ? (int)(num_samples - done) : (1 << 30);
+        if (wav_writer_write(&writer, samples + done, n) < 0) {
+            wav_writer_close(&writer);
+            return -1;
+        }
+        done += n;
+    }
+    return wav_writer_close(&writer);
+}
+
+int write_wav_float(const char *filename, const float *samples, int64_t num_samples, int fs, int format) {
+    WavWriter writer;
+    if (wav_writer_open_sized(filename, &writer, fs, format, num_samples) < 0) return -1;
+    for (int64_t done = 0; done < num_samples; ) {
+        int n = (num_samples - done < (1 << 30)) ? (int)(num_samples - done) : (1 << 30);
+        if (wav_writer_write_float(&writer, samples + done, n) < 0) {
+            wav_writer_close(&writer);
+            return -1;
+        }
+        done += n;
+    }
+    return wav_writer_close(&writer);
+}
+
+int wav_channel_path(char *buf, size_t size, const char *filename, int channel) {
+    // 拡張子の直前に _ch<番号> を挿入する（ディレクトリ名中の '.' は拡張子とみなさない）
+    const char *slash = strrchr(filename, '/');
+    const char *dot = strrchr(filename, '.');
+    if (!dot || (slash && dot < slash)) dot = filename + strlen(filename);
+    int len = snprintf(buf, size, "%.*s_ch%d%s", (int)(dot - filename), filename, channel + 1, dot);
+    if (len < 0 || (size_t)len >= size) {
+        fprintf(stderr, "エラー: ファイル名が長すぎます: %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#ifndef WAV_IO_H
+#define WAV_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * サンプル形式
+ * 読み込みはすべて対応（WAVE_FORMAT_EXTENSIBLE も可）、書き込みは PCM16 と FLOAT32。
+ */
+#define WAV_FORMAT_PCM16   1    // 16bit 整数
+#define WAV_FORMAT_PCM24   2    // 24bit 整数
+#define WAV_FORMAT_PCM32   3    // 32bit 整数
+#define WAV_FORMAT_FLOAT32 4    // IEEE float 32bit
+#define WAV_FORMAT_FLOAT64 5    // IEEE float 64bit
+
+/*
+ * 読み取り専用のWAVデータビュー
+ * ファイルを mmap し、data チャンクをヒープへコピーせずそのまま参照する。
+ * 同じファイルを複数のプロセスで開いてもページキャッシュを共有できる。
+ * mmap できないファイル（パイプなど）は従来どおりヒープへ読み込む。
+ * 多チャンネルのファイルはインタリーブのまま保持する。
+ */
+typedef struct {
+    const void *data;       // data チャンク本体（書き換え不可）
+    int format;             // サンプル形式（WAV_FORMAT_*）
+    int bytes_per_sample;   // 1サンプルのバイト数
+    int channels;           // チャンネル数
+    int64_t num_samples;    // 1チャンネルあたりのサンプル数（フレーム数）
+    int fs;                 // サンプリング周波数
+    void *map;              // mmap 領域（NULL なら data はヒープ上のバッファ）
+    size_t map_size;        // mmap 領域のサイズ
+} WavMap;
+
+/**
+ * WAVファイルを開いてデータを参照できるようにする
+ * 戻り値: 0、エラー時は-1
+ */
+int wav_map_open(const char *filename, WavMap *wav);
+
+/**
+ * offset フレーム目から count フレームを -1.0〜1.0 の float に変換して dst に書き出す
+ * 多チャンネルはインタリーブのまま（dst には count * channels サンプル必要）。
+ */
+void wav_map_read_float(const WavMap *wav, int64_t offset, float *dst, int64_t count);
+
+/**
+ * offset フレーム目から count フレームを float に変換し、チャンネルごとの配列 dst[0..channels-1] に分けて書き出す
+ */
+void wav_map_read_planar(const WavMap *wav, int64_t offset, float *const *dst, int64_t count);
+
+/**
+ * wav_map_open で開いたビューを閉じる
+ */
+void wav_map_close(WavMap *wav);
+
+/*
+ * 逐次読み込み
+ * ファイル全体を読み込まず、呼び出し側のバッファへ指定フレーム数ずつ読み出す。
+ * メモリに収まらない長さの収録も一定のメモリで処理できる。
+ */
+typedef struct {
+    FILE *fp;
+    int fs;                 // サンプリング周波数
+    int format;             // サンプル形式（WAV_FORMAT_*）
+    int bytes_per_sample;   // 1サンプルのバイト数
+    int channels;           // チャンネル数
+    int64_t num_frames;     // 総フレーム数
+    int64_t frames_left;    // 未読のフレーム数
+    unsigned char *raw;     // ファイル上の形式のまま読む作業領域
+    size_t raw_size;
+} WavReader;
+
+/**
+ * WAVファイルを逐次読み込み用に開く
+ * 戻り値: 0、エラー時は-1
+ */
+int wav_reader_open(const char *filename, WavReader *reader);
+
+/**
+ * 最大 max_frames フレームを -1.0〜1.0 の float に変換して buf に読み込む
+ * 多チャンネルはインタリーブのまま（buf には max_frames * channels サンプル必要）。
+ * 戻り値: 読み込んだフレーム数（終端では0）、エラー時は-1
+ */
+int wav_reader_read_float(WavReader *reader, float *buf, int max_frames);
+
+/**
+ * 最大 max_frames フレームを float に変換し、チャンネルごとの配列 planes[0..channels-1] に分けて読み込む
+ * 戻り値: 読み込んだフレーム数（終端では0）、エラー時は-1
+ */
+int wav_reader_read_planar(WavReader *reader, float *const *planes, int max_frames);
+
+/**
+ * 逐次読み込みを終了
+ */
+void wav_reader_close(WavReader *reader);
+
+/*
+ * 逐次書き込み
+ * 開いた時点では仮のヘッダを書き、wav_writer_close でデータ長を確定する。
+ * ヘッダには ds64 チャンク分の JUNK を確保しておき、4GB を超えたら RF64 として閉じる。
+ */
+typedef struct {
+    FILE *fp;
+    int fs;                 // サンプリング周波数
+    int format;             // WAV_FORMAT_PCM16 または WAV_FORMAT_FLOAT32
+    int64_t num_frames;     // 書き込んだフレーム数
+    int reserve_ds64;       // ds64 用の領域をヘッダに確保したか
+} WavWriter;
+
+/**
+ * WAVファイル（モノラル）を書き込み用に開く
+ * format: WAV_FORMAT_PCM16 または WAV_FORMAT_FLOAT32
+ * 戻り値: 0、エラー時は-1
+ */
+int wav_writer_open(const char *filename, WavWriter *writer, int fs, int format);
+
+/**
+ * 書き込むフレーム数 expected_frames が分かっている場合の wav_writer_open
+ * 4GB に収まる長さなら ds64 用の領域を省き、従来と同じ44バイト（PCM16）のヘッダにする。
+ * 戻り値: 0、エラー時は-1
+ */
+int wav_writer_open_sized(const char *filename, WavWriter *writer, int fs, int format,
+                          int64_t expected_frames);
+
+/**
+ * 16bit 整数の num_frames フレームを追記（WAV_FORMAT_PCM16 のときのみ）
+ * 戻り値: 0、エラー時は-1
+ */
+int wav_writer_write(WavWriter *writer, const int16_t *buf, int num_frames);
+
+/**
+ * -1.0〜1.0 の float の num_frames フレームを出力形式に変換して追記
+ * PCM16 へは丸めて範囲外はクリップする。
+ * 戻り値: 0、エラー時は-1
+ */
+int wav_writer_write_float(WavWriter *writer, const float *buf, int num_frames);
+
+/**
+ * ヘッダのデータ長を確定してファイルを閉じる
+ * 戻り値: 0、エラー時は-1
+ */
+int wav_writer_close(WavWriter *writer);
+
+/**
+ * 16bit モノラルのWAVファイルを一括で書き込む（逐次書き込みの簡易版）
+ * 4GB に収まる長さは従来どおり44バイトのヘッダ、超える場合は RF64 で書く。
+ * 戻り値: 0、エラー時は-1
+ */
+int write_wav(const char *filename, const int16_t *samples, int64_t num_samples, int fs);
+
+/**
+ * float のモノラル信号を format（PCM16 / FLOAT32）のWAVファイルに一括で書き込む
+ * 戻り値: 0、エラー時は-1
+ */
+int write_wav_float(const char *filename, const float *samples, int64_t num_samples, int fs, int format);
+
+/**
+ * チャンネルごとの出力ファイル名を作る（"ir.wav" → "ir_ch1.wav"、channel は0始まり）
+ * 戻り値: 0、buf に収まらない場合は-1
+ */
+int wav_channel_path(char *buf, size_t size, const char *filename, int channel);
+
+#endif